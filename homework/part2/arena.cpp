@@ -0,0 +1,61 @@
+#include "arena.hpp"
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+Arena::Arena(size_t blockSize)
+    : m_cursor{nullptr}, m_end{nullptr}, m_blockSize{blockSize},
+      m_capacity{0} {}
+
+Arena::Arena(Arena &&other) noexcept
+    : m_blocks{std::move(other.m_blocks)},
+      m_cursor{std::exchange(other.m_cursor, nullptr)},
+      m_end{std::exchange(other.m_end, nullptr)},
+      m_blockSize{other.m_blockSize},
+      m_capacity{std::exchange(other.m_capacity, 0)} {}
+
+Arena &Arena::operator=(Arena &&other) noexcept {
+  if (this != &other) {
+    m_blocks = std::move(other.m_blocks);
+    m_cursor = std::exchange(other.m_cursor, nullptr);
+    m_end = std::exchange(other.m_end, nullptr);
+    m_blockSize = other.m_blockSize;
+    m_capacity = std::exchange(other.m_capacity, 0);
+  }
+  return *this;
+}
+
+u64 Arena::capacity() const { return m_capacity; }
+
+void *Arena::_allocate(size_t size, size_t align) {
+  auto cursor = reinterpret_cast<uintptr_t>(m_cursor);
+  auto aligned = (cursor + align - 1) & ~(uintptr_t{align} - 1);
+  if (!m_cursor || aligned + size > reinterpret_cast<uintptr_t>(m_end)) {
+    // NOTE: Double the block size every time so the number of blocks stays
+    // logarithmic in the total size. Oversized requests get a block of their
+    // own size.
+    size_t blockSize = m_blockSize;
+    if (!m_blocks.empty()) {
+      m_blockSize *= 2;
+      blockSize = m_blockSize;
+    }
+    if (blockSize < size + align) {
+      blockSize = size + align;
+    }
+
+    m_blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(blockSize));
+    m_cursor = m_blocks.back().get();
+    m_end = m_cursor + blockSize;
+    m_capacity += blockSize;
+
+    cursor = reinterpret_cast<uintptr_t>(m_cursor);
+    aligned = (cursor + align - 1) & ~(uintptr_t{align} - 1);
+  }
+
+  m_cursor = reinterpret_cast<std::byte *>(aligned + size);
+  return reinterpret_cast<void *>(aligned);
+}
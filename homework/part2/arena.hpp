@@ -0,0 +1,45 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator. Allocations are carved out of large blocks and never freed
+// individually; everything goes away at once when the arena is destroyed.
+// Blocks grow geometrically, so a tree of any size lives in a handful of
+// allocations.
+class Arena {
+public:
+  explicit Arena(size_t blockSize = 64 * 1024);
+
+  Arena(Arena const &) = delete;
+  Arena &operator=(Arena const &) = delete;
+  Arena(Arena &&other) noexcept;
+  Arena &operator=(Arena &&other) noexcept;
+
+  // NOTE: Only for trivially destructible types, since nothing in the arena
+  // is ever destroyed.
+  template <typename T> T *allocate(size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>);
+    if (count == 0) {
+      return nullptr;
+    }
+    auto memory = static_cast<T *>(_allocate(count * sizeof(T), alignof(T)));
+    std::uninitialized_default_construct_n(memory, count);
+    return memory;
+  }
+
+  u64 capacity() const;
+
+private:
+  std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+  std::byte *m_cursor;
+  std::byte *m_end;
+  size_t m_blockSize;
+  u64 m_capacity;
+
+  void *_allocate(size_t size, size_t align);
+};
@@ -0,0 +1,265 @@
+#include "float_parser.hpp"
+
+#include "types.hpp"
+
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <system_error>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#include "float_parser_powers.inl"
+
+static constexpr int SmallestPowerOfTen = -342;
+static constexpr int LargestPowerOfTen = 308;
+static constexpr int MantissaBits = 52;
+static constexpr int MinimumExponent = -1023;
+static constexpr int InfinitePower = 0x7ff;
+
+// NOTE: Exactly representable powers of ten. With a mantissa below 2^53 both
+// operands of the Clinger multiply/divide are exact, so IEEE rounding of that
+// single operation gives the correctly rounded result.
+static constexpr f64 ExactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+struct u128_parts {
+  u64 low;
+  u64 high;
+};
+
+static u128_parts Multiply(u64 a, u64 b) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  u128_parts result;
+  result.low = _umul128(a, b, &result.high);
+  return result;
+#else
+  unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+  return {static_cast<u64>(product), static_cast<u64>(product >> 64)};
+#endif
+}
+
+static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+static u64 ReadEight(char const *p) {
+  u64 value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// NOTE: SWAR digit handling from Lemire's fast_float; both assume the eight
+// characters were loaded little-endian.
+static bool IsEightDigits(u64 chars) {
+  return ((chars & 0xf0f0f0f0f0f0f0f0) |
+          (((chars + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) >> 4)) ==
+         0x3333333333333333;
+}
+
+static u32 ParseEightDigits(u64 chars) {
+  constexpr u64 Mask = 0x000000ff000000ff;
+  constexpr u64 Mul1 = 0x000f424000000064; // 100 + (1000000 << 32)
+  constexpr u64 Mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+  chars -= 0x3030303030303030;
+  chars = (chars * 10) + (chars >> 8);
+  chars = (((chars & Mask) * Mul1) + (((chars >> 16) & Mask) * Mul2)) >> 32;
+  return static_cast<u32>(chars);
+}
+
+static f64 MakeF64(bool negative, u64 mantissa, int power2) {
+  u64 bits = mantissa | (static_cast<u64>(power2) << MantissaBits) |
+             (static_cast<u64>(negative) << 63);
+  return std::bit_cast<f64>(bits);
+}
+
+// Eisel-Lemire: multiply the normalized mantissa by a 128-bit approximation of
+// 5^q and read the binary mantissa off the top bits. Returns false in the few
+// cases where the truncated product can't tell which way to round.
+static bool EiselLemire(int64_t q, u64 w, bool negative, f64 &value) {
+  int leadingZeros = std::countl_zero(w);
+  w <<= leadingZeros;
+
+  // NOTE: We need the 52 stored bits, the implicit bit, a rounding bit and one
+  // more in case the product lands below 2^127.
+  constexpr int Precision = MantissaBits + 3;
+  constexpr u64 PrecisionMask = ~u64{0} >> Precision;
+
+  size_t index = 2 * static_cast<size_t>(q - SmallestPowerOfTen);
+  u128_parts product = Multiply(w, PowersOfFive128[index]);
+  if ((product.high & PrecisionMask) == PrecisionMask) {
+    u128_parts lower = Multiply(w, PowersOfFive128[index + 1]);
+    product.low += lower.high;
+    if (lower.high > product.low) {
+      ++product.high;
+    }
+  }
+  if (product.low == ~u64{0} && (q < -27 || q > 55)) {
+    // NOTE: Outside [-27, 55] the table entry is itself inexact, so an
+    // all-ones low word might still carry into the bits we keep.
+    return false;
+  }
+
+  int upperBit = static_cast<int>(product.high >> 63);
+  int shift = upperBit + 64 - Precision;
+  u64 mantissa = product.high >> shift;
+  // NOTE: floor(log2(10^q)) + 63, see Lemire's paper.
+  int power2 = static_cast<int>((((152170 + 65536) * q) >> 16) + 63) +
+               upperBit - leadingZeros - MinimumExponent;
+
+  if (power2 <= 0) {
+    // Subnormal (or zero).
+    if (-power2 + 1 >= 64) {
+      value = MakeF64(negative, 0, 0);
+      return true;
+    }
+    mantissa >>= -power2 + 1;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    // NOTE: Rounding up may carry into the smallest normal number.
+    power2 = mantissa < (u64{1} << MantissaBits) ? 0 : 1;
+    value = MakeF64(negative, mantissa & ~(u64{1} << MantissaBits), power2);
+    return true;
+  }
+
+  // NOTE: Exact halfway cases need round-to-even. They can only occur when 5^q
+  // fits in 64 bits, so the product is exact and we can see that only zeros
+  // were shifted out.
+  if (product.low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+      (mantissa << shift) == product.high) {
+    mantissa &= ~u64{1};
+  }
+
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >= (u64{2} << MantissaBits)) {
+    mantissa = u64{1} << MantissaBits;
+    ++power2;
+  }
+  mantissa &= ~(u64{1} << MantissaBits);
+
+  if (power2 >= InfinitePower) {
+    power2 = InfinitePower;
+    mantissa = 0;
+  }
+  value = MakeF64(negative, mantissa, power2);
+  return true;
+}
+
+static bool FromChars(std::string_view text, bool negative, int64_t exponent,
+                      f64 &value) {
+  auto [end, ec] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  if (ec == std::errc::result_out_of_range) {
+    // NOTE: Match strtod, which saturates instead of failing.
+    value = exponent < 0 ? 0.0 : std::numeric_limits<f64>::infinity();
+    value = negative ? -value : value;
+    return true;
+  }
+  return ec == std::errc{} && end == text.data() + text.size();
+}
+
+bool parseF64(std::string_view text, f64 &value) {
+  char const *p = text.data();
+  char const *end = p + text.size();
+
+  bool negative = p != end && *p == '-';
+  if (negative) {
+    ++p;
+  }
+
+  // NOTE: Accumulate every digit and only look at how many there were
+  // afterwards. The mantissa wraps past 19 digits, in which case we
+  // recount and send the number to the slow path.
+  u64 mantissa = 0;
+  char const *integer = p;
+  for (; p != end && IsDigit(*p); ++p) {
+    mantissa = mantissa * 10 + static_cast<u64>(*p - '0');
+  }
+  char const *integerEnd = p;
+  if (p == integer) {
+    return false;
+  }
+
+  int64_t exponent = 0;
+  if (p != end && *p == '.') {
+    char const *fraction = ++p;
+    while (end - p >= 8 && IsEightDigits(ReadEight(p))) {
+      mantissa = mantissa * 100000000 + ParseEightDigits(ReadEight(p));
+      p += 8;
+    }
+    for (; p != end && IsDigit(*p); ++p) {
+      mantissa = mantissa * 10 + static_cast<u64>(*p - '0');
+    }
+    if (p == fraction) {
+      return false;
+    }
+    exponent = fraction - p;
+  }
+  int64_t digits = (p - integer) - (p != integerEnd);
+
+  if (p != end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    bool negativeExponent = p != end && *p == '-';
+    if (p != end && (*p == '-' || *p == '+')) {
+      ++p;
+    }
+    if (p == end || !IsDigit(*p)) {
+      return false;
+    }
+    int64_t explicitExponent = 0;
+    for (; p != end && IsDigit(*p); ++p) {
+      // NOTE: Saturate; anything this large is zero or infinity anyway.
+      if (explicitExponent < 0x10000) {
+        explicitExponent = explicitExponent * 10 + (*p - '0');
+      }
+    }
+    exponent += negativeExponent ? -explicitExponent : explicitExponent;
+  }
+
+  if (p != end) {
+    return false;
+  }
+
+  if (digits > 19) {
+    // NOTE: Leading zeros ("0.000123") don't count towards the 19 digits.
+    char const *first = integer;
+    while (first != end && (*first == '0' || *first == '.')) {
+      digits -= *first == '0';
+      ++first;
+    }
+    if (digits > 19) {
+      return FromChars(text, negative, exponent, value);
+    }
+  }
+
+  if (mantissa == 0 || exponent < SmallestPowerOfTen) {
+    value = MakeF64(negative, 0, 0);
+    return true;
+  }
+  if (exponent > LargestPowerOfTen) {
+    value = MakeF64(negative, 0, InfinitePower);
+    return true;
+  }
+
+  if (exponent >= -22 && exponent <= 22 && mantissa <= (u64{1} << 53)) {
+    f64 result = static_cast<f64>(mantissa);
+    if (exponent < 0) {
+      result /= ExactPowersOfTen[-exponent];
+    } else {
+      result *= ExactPowersOfTen[exponent];
+    }
+    value = negative ? -result : result;
+    return true;
+  }
+
+  if (EiselLemire(exponent, mantissa, negative, value)) {
+    return true;
+  }
+  return FromChars(text, negative, exponent, value);
+}
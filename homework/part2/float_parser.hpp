@@ -0,0 +1,12 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <string_view>
+
+// Parses a complete JSON number into the nearest f64, rounding exactly like
+// strtod does. Returns false when text is not a valid number. Numbers with at
+// most 19 significant digits are converted without leaving registers (Clinger's
+// fast path, then the Eisel-Lemire algorithm); the rare cases those can't
+// decide fall back to std::from_chars.
+bool parseF64(std::string_view text, f64 &value);
@@ -0,0 +1,146 @@
+#include "float_parser.hpp"
+#include "metrics.hpp"
+#include "types.hpp"
+
+#include <bit>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct number_set {
+  std::string name;
+  std::string text;
+  std::vector<std::string_view> numbers;
+};
+
+// NOTE: Every number is followed by a ',' so strtod stops where the JSON
+// tokenizer would.
+static number_set makeNumbers(std::string name, char const *format,
+                              u64 count) {
+  std::mt19937_64 gen{count};
+  std::uniform_real_distribution<f64> coordinate{-180.0, 180.0};
+  std::uniform_real_distribution<f64> small{-1e-3, 1e-3};
+
+  number_set set{std::move(name), {}, {}};
+  std::vector<size_t> offsets;
+  char buffer[64];
+  for (u64 i = 0; i < count; ++i) {
+    // NOTE: The generator occasionally writes values close to zero, which
+    // come out in exponent form.
+    f64 value = (i % 16 == 0) ? small(gen) : coordinate(gen);
+    int length = std::snprintf(buffer, sizeof(buffer), format, value);
+    offsets.push_back(set.text.size());
+    set.text.append(buffer, length);
+    set.text.push_back(',');
+  }
+  offsets.push_back(set.text.size());
+
+  for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+    set.numbers.emplace_back(set.text.data() + offsets[i],
+                             offsets[i + 1] - offsets[i] - 1);
+  }
+  return set;
+}
+
+static f64 parseStrtod(std::string_view number) {
+  return std::strtod(number.data(), nullptr);
+}
+
+static f64 parseFromChars(std::string_view number) {
+  f64 value = 0;
+  std::from_chars(number.data(), number.data() + number.size(), value);
+  return value;
+}
+
+static f64 parseFast(std::string_view number) {
+  f64 value = 0;
+  parseF64(number, value);
+  return value;
+}
+
+struct benchmark_result {
+  u64 cycles;
+  u64 checksum;
+};
+
+template <typename Parse>
+static benchmark_result benchmark(number_set const &set, Parse parse,
+                                  u32 repetitions) {
+  benchmark_result result{~u64{0}, 0};
+  for (u32 r = 0; r < repetitions; ++r) {
+    u64 checksum = 0;
+    u64 begin = ReadCPUTimer();
+    for (auto number : set.numbers) {
+      checksum += std::bit_cast<u64>(parse(number));
+    }
+    u64 elapsed = ReadCPUTimer() - begin;
+    if (elapsed < result.cycles) {
+      result.cycles = elapsed;
+    }
+    result.checksum = checksum;
+  }
+  return result;
+}
+
+static void print(std::string_view name, number_set const &set,
+                  benchmark_result result, u64 cpuFreq) {
+  f64 seconds = static_cast<f64>(result.cycles) / cpuFreq;
+  f64 count = static_cast<f64>(set.numbers.size());
+  std::printf("  %-12.*s %8.2f cycles/number  %7.2f ns/number  %8.2f MB/s\n",
+              static_cast<int>(name.size()), name.data(),
+              result.cycles / count, 1e9 * seconds / count,
+              set.text.size() / seconds / (1024.0 * 1024.0));
+}
+
+int main(int argc, char *argv[]) {
+  u64 count = 1000000;
+  u32 repetitions = 10;
+  if (argc >= 2) {
+    count = std::strtoull(argv[1], nullptr, 10);
+  }
+  if (argc >= 3) {
+    repetitions = static_cast<u32>(std::strtoul(argv[2], nullptr, 10));
+  }
+  if (count == 0 || repetitions == 0) {
+    std::cerr << "Usage: " << argv[0] << " [count] [repetitions]\n";
+    return 1;
+  }
+
+  u64 cpuFreq = GetCPUFreq();
+
+  // NOTE: %.19g matches what haversine_generator writes
+  // (long double digits10 + 1); %.17g is the shortest precision that always
+  // round-trips an f64, and %.16g is typical of other JSON writers.
+  number_set sets[] = {
+      makeNumbers("19 digits", "%.19g", count),
+      makeNumbers("17 digits", "%.17g", count),
+      makeNumbers("16 digits", "%.16g", count),
+  };
+
+  bool mismatch = false;
+  for (auto const &set : sets) {
+    std::printf("%s (%llu numbers, %llu bytes):\n", set.name.c_str(),
+                static_cast<unsigned long long>(set.numbers.size()),
+                static_cast<unsigned long long>(set.text.size()));
+
+    auto strtodResult = benchmark(set, parseStrtod, repetitions);
+    auto fromCharsResult = benchmark(set, parseFromChars, repetitions);
+    auto fastResult = benchmark(set, parseFast, repetitions);
+    print("strtod", set, strtodResult, cpuFreq);
+    print("from_chars", set, fromCharsResult, cpuFreq);
+    print("parseF64", set, fastResult, cpuFreq);
+
+    if (fastResult.checksum != strtodResult.checksum ||
+        fromCharsResult.checksum != strtodResult.checksum) {
+      std::printf("  MISMATCH: results differ from strtod\n");
+      mismatch = true;
+    }
+  }
+
+  return mismatch ? 1 : 0;
+}
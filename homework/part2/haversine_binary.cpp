@@ -0,0 +1,153 @@
+#include "haversine_binary.hpp"
+
+#include "haversine_parser.hpp"
+#include "input_file.hpp"
+#include "types.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static constexpr u64 PendingPairCount = 4096;
+
+static u64 AlignUp(u64 value, u64 alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+HaversineBinaryWriter::HaversineBinaryWriter(std::filesystem::path const &path,
+                                             u64 pairCount, u64 seed,
+                                             haversine_method method)
+    : m_file{path, std::ios_base::binary}, m_header{}, m_flushed{0} {
+  if (!m_file) {
+    throw std::runtime_error{"Unable to create " + path.string()};
+  }
+
+  u64 blockSize = AlignUp(pairCount * sizeof(f64), HvbAlignment);
+  m_header.magic = HvbMagic;
+  m_header.version = HvbVersion;
+  m_header.pairCount = pairCount;
+  m_header.seed = seed;
+  m_header.method = method;
+  m_header.headerSize = sizeof(hvb_header);
+  m_header.x0Offset = AlignUp(sizeof(hvb_header), HvbAlignment);
+  m_header.y0Offset = m_header.x0Offset + blockSize;
+  m_header.x1Offset = m_header.y0Offset + blockSize;
+  m_header.y1Offset = m_header.x1Offset + blockSize;
+  m_header.answersOffset = m_header.y1Offset + blockSize;
+
+  m_pending.reserve(PendingPairCount);
+  m_answers.reserve(PendingPairCount);
+}
+
+void HaversineBinaryWriter::write(haversine_pair const &pair, f64 answer) {
+  m_pending.push_back(pair);
+  m_answers.push_back(answer);
+  if (m_answers.size() == PendingPairCount) {
+    _flush();
+  }
+}
+
+void HaversineBinaryWriter::finish(f64 expectedSum) {
+  _flush();
+  if (m_flushed != m_header.pairCount) {
+    throw std::runtime_error{"Pair count doesn't match the .hvb header"};
+  }
+
+  // NOTE: The header goes in last, so a file from an interrupted run never
+  // has a valid magic.
+  m_header.expectedSum = expectedSum;
+  m_file.seekp(0);
+  m_file.write(reinterpret_cast<char const *>(&m_header), sizeof(m_header));
+  m_file.flush();
+  if (!m_file) {
+    throw std::runtime_error{"Unable to write .hvb file"};
+  }
+}
+
+void HaversineBinaryWriter::_flush() {
+  auto writeBlock = [this](u64 offset, std::vector<f64> &values) {
+    m_file.seekp(offset + m_flushed * sizeof(f64));
+    m_file.write(reinterpret_cast<char const *>(values.data()),
+                 values.size() * sizeof(f64));
+    values.clear();
+  };
+
+  u64 count = m_answers.size();
+  if (m_flushed + count > m_header.pairCount) {
+    throw std::runtime_error{"Pair count doesn't match the .hvb header"};
+  }
+  writeBlock(m_header.x0Offset, m_pending.x0);
+  writeBlock(m_header.y0Offset, m_pending.y0);
+  writeBlock(m_header.x1Offset, m_pending.x1);
+  writeBlock(m_header.y1Offset, m_pending.y1);
+  writeBlock(m_header.answersOffset, m_answers);
+  m_flushed += count;
+
+  if (!m_file) {
+    throw std::runtime_error{"Unable to write .hvb file"};
+  }
+}
+
+HaversineBinaryFile::HaversineBinaryFile(std::filesystem::path const &path)
+    : m_file{path}, m_header{} {
+  auto bytes = m_file.view();
+  if (bytes.size() < sizeof(hvb_header)) {
+    throw std::runtime_error{"Truncated .hvb header"};
+  }
+  std::memcpy(&m_header, bytes.data(), sizeof(m_header));
+
+  if (m_header.magic != HvbMagic) {
+    throw std::runtime_error{"Not a .hvb file"};
+  }
+  if (m_header.version != HvbVersion) {
+    throw std::runtime_error{"Unsupported .hvb version " +
+                             std::to_string(m_header.version)};
+  }
+
+  // NOTE: Validate every block up front so the spans handed out later can't
+  // run off the end of the mapping.
+  u64 blockBytes = m_header.pairCount * sizeof(f64);
+  if (m_header.pairCount > bytes.size() / sizeof(f64)) {
+    throw std::runtime_error{"Corrupt .hvb pair count"};
+  }
+  for (u64 offset : {m_header.x0Offset, m_header.y0Offset, m_header.x1Offset,
+                     m_header.y1Offset, m_header.answersOffset}) {
+    if (offset % sizeof(f64) != 0 || offset < m_header.headerSize ||
+        offset > bytes.size() || bytes.size() - offset < blockBytes) {
+      throw std::runtime_error{"Corrupt .hvb block offset"};
+    }
+  }
+}
+
+hvb_header const &HaversineBinaryFile::header() const { return m_header; }
+
+haversine_pairs_view HaversineBinaryFile::pairs() const {
+  return haversine_pairs_view{_block(m_header.x0Offset),
+                              _block(m_header.y0Offset),
+                              _block(m_header.x1Offset),
+                              _block(m_header.y1Offset)};
+}
+
+std::span<f64 const> HaversineBinaryFile::answers() const {
+  return _block(m_header.answersOffset);
+}
+
+std::span<f64 const> HaversineBinaryFile::_block(u64 offset) const {
+  return {reinterpret_cast<f64 const *>(m_file.view().data() + offset),
+          m_header.pairCount};
+}
+
+char const *getHaversineMethodName(haversine_method method) {
+  switch (method) {
+  case haversine_method::Uniform:
+    return "uniform";
+  case haversine_method::Cluster:
+    return "cluster";
+  }
+  return "unknown";
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "haversine_parser.hpp"
+#include "input_file.hpp"
+#include "types.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <vector>
+
+// .hvb: binary pair container, so compute benchmarks don't have to pay for
+// JSON parsing. Layout (little-endian):
+//
+//   hvb_header                      128 bytes
+//   x0[pairCount]                   f64, starts on a 64-byte boundary
+//   y0[pairCount]                   f64, starts on a 64-byte boundary
+//   x1[pairCount]                   f64, starts on a 64-byte boundary
+//   y1[pairCount]                   f64, starts on a 64-byte boundary
+//   answers[pairCount]              f64, per-pair reference distances
+//
+// Block offsets are stored in the header, so readers never have to recompute
+// the padding. Bump HvbVersion on any incompatible change.
+inline constexpr u32 HvbMagic = 0x00425648; // "HVB\0"
+inline constexpr u32 HvbVersion = 1;
+inline constexpr u64 HvbAlignment = 64;
+
+enum class haversine_method : u32 {
+  Uniform,
+  Cluster,
+};
+
+struct hvb_header {
+  u32 magic;
+  u32 version;
+  u64 pairCount;
+  u64 seed;
+  haversine_method method;
+  u32 headerSize;
+  f64 expectedSum; // mean of answers, as written to the .f64 file
+  u64 x0Offset;
+  u64 y0Offset;
+  u64 x1Offset;
+  u64 y1Offset;
+  u64 answersOffset;
+  u64 reserved[6];
+};
+static_assert(sizeof(hvb_header) == 128);
+
+// Writes pairs as they are generated. Each coordinate is buffered per block
+// and flushed in runs to its own region of the file, so memory use doesn't
+// grow with pairCount.
+class HaversineBinaryWriter {
+public:
+  HaversineBinaryWriter(std::filesystem::path const &path, u64 pairCount,
+                        u64 seed, haversine_method method);
+
+  void write(haversine_pair const &pair, f64 answer);
+  // Flushes the remaining pairs and writes the header. Throws if fewer or
+  // more than pairCount pairs were written.
+  void finish(f64 expectedSum);
+
+private:
+  std::ofstream m_file;
+  hvb_header m_header;
+  u64 m_flushed;
+  haversine_pairs m_pending;
+  std::vector<f64> m_answers;
+
+  void _flush();
+};
+
+// Zero-copy reader: the file is memory-mapped and the coordinate and answer
+// spans point straight into the mapping.
+class HaversineBinaryFile {
+public:
+  explicit HaversineBinaryFile(std::filesystem::path const &path);
+
+  hvb_header const &header() const;
+  haversine_pairs_view pairs() const;
+  std::span<f64 const> answers() const;
+
+private:
+  InputFile m_file;
+  hvb_header m_header;
+
+  std::span<f64 const> _block(u64 offset) const;
+};
+
+char const *getHaversineMethodName(haversine_method method);
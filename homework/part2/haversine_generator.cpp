@@ -1,13 +1,40 @@
+#include "haversine_binary.hpp"
 #include "haversine_math.hpp"
 #include "types.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
-#include <iomanip>
 #include <ios>
 #include <iostream>
-#include <limits>
+#include <mutex>
+#include <optional>
 #include <random>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// NOTE: Pairs are generated in fixed-size chunks, each with its own RNG
+// seeded from the master seed and the chunk index. The output therefore only
+// depends on the seed, never on how many threads produced it. Chunks are a
+// multiple of the 64-pair cluster size, so clusters never straddle two.
+static constexpr u64 ChunkPairCount = 64 * 1024;
+static constexpr u64 ClusterPairCount = 64;
+
+// NOTE: Longest line we can produce: four shortest-roundtrip f64s (at most 24
+// characters each) plus the keys and punctuation.
+static constexpr u64 MaxPairLineSize = 4 * 24 + 64;
+
+struct generator_chunk {
+  std::string Json;
+  haversine_pairs Pairs;
+  std::vector<f64> Answers;
+};
 
 std::uniform_real_distribution<> getDistribution(f64 center, f64 radius,
                                                  f64 limit) {
@@ -24,18 +51,135 @@ std::uniform_real_distribution<> getDistribution(f64 center, f64 radius,
   return std::uniform_real_distribution<>(min, max);
 }
 
-int main(int argc, char *argv[]) {
+static u64 SplitMix64(u64 &State) {
+  u64 Result = (State += 0x9e3779b97f4a7c15);
+  Result = (Result ^ (Result >> 30)) * 0xbf58476d1ce4e5b9;
+  Result = (Result ^ (Result >> 27)) * 0x94d049bb133111eb;
+  return Result ^ (Result >> 31);
+}
+
+static std::mt19937 MakeChunkGenerator(u64 &State) {
+  u64 Seed = SplitMix64(State);
+  std::seed_seq Sequence{static_cast<u32>(Seed), static_cast<u32>(Seed >> 32)};
+  return std::mt19937{Sequence};
+}
+
+static char *AppendString(char *At, std::string_view String) {
+  std::memcpy(At, String.data(), String.size());
+  return At + String.size();
+}
+
+static char *AppendF64(char *At, f64 Value) {
+  // NOTE: to_chars without a precision prints the shortest representation
+  // that round-trips, which is both exact and far cheaper than ostream.
+  return std::to_chars(At, At + 24, Value).ptr;
+}
+
+static void GenerateChunk(generator_chunk &Chunk, u64 SeedValue,
+                          haversine_method Method, u64 ChunkIndex,
+                          u64 FirstPair, u64 PairCount, bool IsLastChunk,
+                          bool WriteJson, bool WriteBinary) {
   f64 EarthRadius = 6372.8;
+  f64 MaxAllowedX = 180;
+  f64 MaxAllowedY = 90;
+
+  u64 State = SeedValue ^ (ChunkIndex * 0xd1b54a32d192ed03);
+  std::mt19937 Xgen = MakeChunkGenerator(State);
+  std::mt19937 Ygen = MakeChunkGenerator(State);
+  std::uniform_real_distribution<> Xdis(-MaxAllowedX, MaxAllowedX);
+  std::uniform_real_distribution<> XcenterDis(-MaxAllowedX, MaxAllowedX);
+  std::uniform_real_distribution<> XradiusDis(0, MaxAllowedX);
+  std::uniform_real_distribution<> Ydis(-MaxAllowedY, MaxAllowedY);
+  std::uniform_real_distribution<> YcenterDis(-MaxAllowedY, MaxAllowedY);
+  std::uniform_real_distribution<> YradiusDis(0, MaxAllowedY);
+
+  Chunk.Json.resize(WriteJson ? PairCount * MaxPairLineSize + 16 : 0);
+  char *At = Chunk.Json.data();
+  if (WriteJson && FirstPair == 0) {
+    At = AppendString(At, "{\"pairs\":[\n");
+  }
+  Chunk.Pairs = haversine_pairs{};
+  if (WriteBinary) {
+    Chunk.Pairs.reserve(PairCount);
+  }
+  Chunk.Answers.resize(PairCount);
+
+  for (u64 n = 0; n < PairCount; n++) {
+    if (Method == haversine_method::Cluster && n % ClusterPairCount == 0) {
+      f64 Xcenter = XcenterDis(Xgen);
+      f64 Ycenter = YcenterDis(Ygen);
+      f64 Xradius = XradiusDis(Xgen);
+      f64 Yradius = YradiusDis(Ygen);
+      Xdis = getDistribution(Xcenter, Xradius, MaxAllowedX);
+      Ydis = getDistribution(Ycenter, Yradius, MaxAllowedY);
+    }
+    f64 X0 = Xdis(Xgen);
+    f64 X1 = Xdis(Xgen);
+    f64 Y0 = Ydis(Ygen);
+    f64 Y1 = Ydis(Ygen);
+
+    Chunk.Answers[n] = ReferenceHaversine(X0, Y0, X1, Y1, EarthRadius);
+
+    if (WriteJson) {
+      At = AppendString(At, "\t{\"x0\":");
+      At = AppendF64(At, X0);
+      At = AppendString(At, ", \"y0\":");
+      At = AppendF64(At, Y0);
+      At = AppendString(At, ", \"x1\":");
+      At = AppendF64(At, X1);
+      At = AppendString(At, ", \"y1\":");
+      At = AppendF64(At, Y1);
+      bool IsLastPair = IsLastChunk && n + 1 == PairCount;
+      At = AppendString(At, IsLastPair ? "}\n" : "},\n");
+    }
+    if (WriteBinary) {
+      Chunk.Pairs.push_back(haversine_pair{X0, Y0, X1, Y1});
+    }
+  }
+
+  if (WriteJson && IsLastChunk) {
+    At = AppendString(At, "]}");
+  }
+  Chunk.Json.resize(At - Chunk.Json.data());
+}
+
+int main(int argc, char *argv[]) {
   u64 MaxPairCount = (1ULL << 34);
 
-  if (argc == 4) {
+  constexpr std::string_view FormatFlag = "--format=";
+  constexpr std::string_view ThreadsFlag = "--threads=";
+  char const *Program = argv[0];
+  bool WriteJson = true;
+  bool WriteBinary = false;
+  u32 ThreadCount = std::thread::hardware_concurrency();
+  bool Valid = true;
+  for (; argc > 1 && std::string_view{argv[1]}.starts_with("--");
+       argc--, argv++) {
+    std::string_view Option = argv[1];
+    if (Option.starts_with(FormatFlag)) {
+      auto Format = Option.substr(FormatFlag.size());
+      WriteJson = (Format == "json" || Format == "both");
+      WriteBinary = (Format == "hvb" || Format == "both");
+      Valid &= (WriteJson || WriteBinary);
+    } else if (Option.starts_with(ThreadsFlag)) {
+      ThreadCount = std::atoi(Option.substr(ThreadsFlag.size()).data());
+      if (ThreadCount == 0) {
+        ThreadCount = std::thread::hardware_concurrency();
+      }
+    } else {
+      Valid = false;
+    }
+  }
+  ThreadCount = std::max(ThreadCount, 1u);
+
+  if (Valid && argc == 4) {
     char const *MethodName = argv[1];
     u64 SeedValue = atoll(argv[2]);
     size_t PairCount = atoll(argv[3]);
 
-    auto ClusterCountLeft = std::numeric_limits<u64>::max();
+    auto Method = haversine_method::Uniform;
     if (strcmp(MethodName, "cluster") == 0) {
-      ClusterCountLeft = 0;
+      Method = haversine_method::Cluster;
     } else if (strcmp(MethodName, "uniform") != 0) {
       MethodName = "uniform";
       std::cerr << "WARNING: Unrecognized method name. Using 'uniform'.\n";
@@ -48,56 +192,128 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
-    f64 MaxAllowedX = 180;
-    f64 MaxAllowedY = 90;
-
-    std::mt19937 Xgen;
-    Xgen.seed(SeedValue);
-    std::uniform_real_distribution<> Xdis(-MaxAllowedX, MaxAllowedX);
-    std::uniform_real_distribution<> XcenterDis(-MaxAllowedX, MaxAllowedX);
-    std::uniform_real_distribution<> XradiusDis(0, MaxAllowedX);
-    std::mt19937 Ygen;
-    Ygen.seed(SeedValue);
-    std::uniform_real_distribution<> Ydis(-MaxAllowedY, MaxAllowedY);
-    std::uniform_real_distribution<> YcenterDis(-MaxAllowedY, MaxAllowedY);
-    std::uniform_real_distribution<> YradiusDis(0, MaxAllowedY);
-
     std::string jsonFile = "data_" + std::to_string(PairCount) + "_flex.json";
-    std::ofstream json{jsonFile};
+    std::ofstream json;
     std::string haverFile =
         "data_" + std::to_string(PairCount) + "_haveranswer.f64";
-    std::ofstream haver{haverFile, std::ios_base::binary};
-    constexpr auto max_precision{std::numeric_limits<long double>::digits10 +
-                                 1};
-    json << "{\"pairs\":[\n" << std::setprecision(max_precision);
+    std::ofstream haver;
+    if (WriteJson) {
+      json.open(jsonFile, std::ios_base::binary);
+      haver.open(haverFile, std::ios_base::binary);
+    }
+
+    std::optional<HaversineBinaryWriter> Binary;
+    if (WriteBinary) {
+      Binary.emplace("data_" + std::to_string(PairCount) + "_flex.hvb",
+                     PairCount, SeedValue, Method);
+    }
+
+    // NOTE: Workers fill a ring of InFlightCount chunk slots; this thread
+    // drains them strictly in chunk order, so the files come out identical
+    // whatever the thread count while memory stays bounded.
+    u64 ChunkCount = (PairCount + ChunkPairCount - 1) / ChunkPairCount;
+    u64 InFlightCount = 2 * ThreadCount;
+    std::vector<generator_chunk> Chunks(InFlightCount);
+    std::vector<u64> ReadyChunk(InFlightCount, ~0ull);
+    u64 WrittenCount = 0;
+    bool Stop = false;
+    std::atomic<u64> NextChunk{0};
+    std::mutex Mutex;
+    std::condition_variable Changed;
+
+    auto Worker = [&] {
+      for (u64 ChunkIndex = NextChunk++; ChunkIndex < ChunkCount;
+           ChunkIndex = NextChunk++) {
+        u64 Slot = ChunkIndex % InFlightCount;
+        {
+          std::unique_lock Lock{Mutex};
+          Changed.wait(Lock, [&] {
+            return Stop || ChunkIndex < WrittenCount + InFlightCount;
+          });
+          if (Stop) {
+            return;
+          }
+        }
+
+        u64 FirstPair = ChunkIndex * ChunkPairCount;
+        u64 Count = std::min<u64>(ChunkPairCount, PairCount - FirstPair);
+        GenerateChunk(Chunks[Slot], SeedValue, Method, ChunkIndex, FirstPair,
+                      Count, ChunkIndex + 1 == ChunkCount, WriteJson,
+                      WriteBinary);
 
+        {
+          std::lock_guard Lock{Mutex};
+          ReadyChunk[Slot] = ChunkIndex;
+        }
+        Changed.notify_all();
+      }
+    };
+
+    std::vector<std::thread> Threads;
+    for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++) {
+      Threads.emplace_back(Worker);
+    }
+
+    // NOTE: Summing the answers here, in pair order, keeps the expected sum
+    // bit-identical to what a serial pass over the output computes.
     f64 Sum = 0;
-    for (int n = 0; n < PairCount; n++) {
-      if (n % 64 == 0) {
-        f64 Xcenter = XcenterDis(Xgen);
-        f64 Ycenter = YcenterDis(Ygen);
-        f64 Xradius = XradiusDis(Xgen);
-        f64 Yradius = YradiusDis(Ygen);
-        Xdis = getDistribution(Xcenter, Xradius, MaxAllowedX);
-        Ydis = getDistribution(Ycenter, Yradius, MaxAllowedY);
+    try {
+      for (u64 ChunkIndex = 0; ChunkIndex < ChunkCount; ChunkIndex++) {
+        u64 Slot = ChunkIndex % InFlightCount;
+        {
+          std::unique_lock Lock{Mutex};
+          Changed.wait(Lock, [&] { return ReadyChunk[Slot] == ChunkIndex; });
+        }
+
+        auto &Chunk = Chunks[Slot];
+        for (f64 Answer : Chunk.Answers) {
+          Sum += Answer;
+        }
+        if (WriteJson) {
+          json.write(Chunk.Json.data(), Chunk.Json.size());
+          haver.write(reinterpret_cast<char const *>(Chunk.Answers.data()),
+                      Chunk.Answers.size() * sizeof(f64));
+        }
+        if (Binary) {
+          for (u64 n = 0; n < Chunk.Answers.size(); n++) {
+            Binary->write(haversine_pair{Chunk.Pairs.x0[n], Chunk.Pairs.y0[n],
+                                         Chunk.Pairs.x1[n], Chunk.Pairs.y1[n]},
+                          Chunk.Answers[n]);
+          }
+        }
+
+        {
+          std::lock_guard Lock{Mutex};
+          ReadyChunk[Slot] = ~0ull;
+          WrittenCount = ChunkIndex + 1;
+        }
+        Changed.notify_all();
+      }
+    } catch (...) {
+      {
+        std::lock_guard Lock{Mutex};
+        Stop = true;
       }
-      f64 X0 = Xdis(Xgen);
-      f64 X1 = Xdis(Xgen);
-      f64 Y0 = Ydis(Ygen);
-      f64 Y1 = Ydis(Ygen);
-
-      f64 HaversineDistance = ReferenceHaversine(X0, Y0, X1, Y1, EarthRadius);
-      Sum += HaversineDistance;
-
-      json << "\t{\"x0\":" << X0 << ", " << "\"y0\":" << Y0 << ", "
-           << "\"x1\":" << X1 << ", " << "\"y1\":" << Y1 << "},\n";
-      haver.write(reinterpret_cast<char *>(&HaversineDistance),
-                  sizeof(HaversineDistance));
+      Changed.notify_all();
+      for (auto &Thread : Threads) {
+        Thread.join();
+      }
+      throw;
+    }
+    for (auto &Thread : Threads) {
+      Thread.join();
     }
-    json.seekp(-3, std::ios_base::end);
-    json << "\n]}";
+
     Sum /= static_cast<f64>(PairCount);
-    haver.write(reinterpret_cast<char *>(&Sum), sizeof(Sum));
+    if (WriteJson) {
+      if (PairCount == 0) {
+        json << "{\"pairs\":[\n]}";
+      }
+      haver.write(reinterpret_cast<char *>(&Sum), sizeof(Sum));
+    }
+    if (Binary) {
+      Binary->finish(Sum);
+    }
 
     std::cout << "Method: " << MethodName << '\n'
               << "Random seed: " << SeedValue << '\n'
@@ -105,9 +321,14 @@ int main(int argc, char *argv[]) {
               << "Expected sum: " << Sum << '\n';
 
   } else {
-    std::cerr << "Usage: " << argv[0]
-              << " [uniform/cluster] [random seed] "
-                 "[number of coordinate pairs to generate]\n";
+    std::cerr << "Usage: " << Program
+              << " [options] [uniform/cluster] [random seed] "
+                 "[number of coordinate pairs to generate]\n"
+              << "Options:\n"
+              << "  --format=json|hvb|both  write the JSON and .f64 answers "
+                 "(default), a .hvb binary file or all of them\n"
+              << "  --threads=N             generate on N threads, 0 for one "
+                 "per core (default: 0)\n";
     return 1;
   }
 
@@ -14,9 +14,45 @@
    LISTING 65
    ======================================================================== */
 
+#include "haversine_math.hpp"
+
 #include "types.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <span>
+
+#if _WIN32
+
+#include <intrin.h>
+
+#define TARGET_AVX2
+#define TARGET_AVX512
+
+#else
+
+#include <cpuid.h>
+
+// NOTE: GCC 12's AVX-512 intrinsics fill unused lanes from
+// _mm512_undefined_pd(), which it writes as a self-initialised variable, so
+// _mm512_sqrt_pd, _mm512_min_pd and friends warn -Wuninitialized wherever
+// they are inlined, whatever their arguments are (GCC bug 105593, fixed in
+// GCC 13 by the same pragmas inside the header). The warnings point at the
+// header, so silencing them around the include covers only that.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#else
+#include <immintrin.h>
+#endif
+
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+
+#endif
 
 static f64 Square(f64 A) {
   f64 Result = (A * A);
@@ -54,3 +90,417 @@ f64 ReferenceHaversine(f64 X0, f64 Y0, f64 X1, f64 Y1, f64 EarthRadius) {
 
   return Result;
 }
+
+static f64 SumHaversineReference(std::span<f64 const> X0,
+                                 std::span<f64 const> Y0,
+                                 std::span<f64 const> X1,
+                                 std::span<f64 const> Y1, f64 EarthRadius) {
+  constexpr u64 BlockSize = 16;
+
+  u64 Count = X0.size();
+  f64 Distances[BlockSize];
+  f64 Sum = 0;
+  for (u64 Base = 0; Base < Count; Base += BlockSize) {
+    u64 BlockCount = std::min(BlockSize, Count - Base);
+
+    // NOTE: Distances within a block don't depend on each other, so they can
+    // overlap in the pipeline; only the accumulation below is serial.
+    for (u64 Index = 0; Index < BlockCount; ++Index) {
+      u64 PairIndex = Base + Index;
+      Distances[Index] = ReferenceHaversine(X0[PairIndex], Y0[PairIndex],
+                                            X1[PairIndex], Y1[PairIndex],
+                                            EarthRadius);
+    }
+
+    for (u64 Index = 0; Index < BlockCount; ++Index) {
+      Sum += Distances[Index];
+    }
+  }
+
+  return Sum;
+}
+
+/* NOTE: The polynomials below are SinCE and ASinCE from the course's math
+   replacement listing (minimax coefficients by Demetri Spanos), evaluated
+   lane-wise. SinCE is accurate on [-Pi, Pi], which covers dLat/2, dLon/2 and
+   lat + Pi/2 for valid coordinates. */
+
+constexpr f64 Pi64 = 3.14159265358979323846264338327950288;
+
+TARGET_AVX2 static __m256d SinCE_4x(__m256d OrigX) {
+  __m256d SignMask = _mm256_set1_pd(-0.0);
+  __m256d PosX = _mm256_andnot_pd(SignMask, OrigX);
+  // NOTE: For PosX in [0, Pi], min(PosX, Pi - PosX) folds (Pi/2, Pi] back
+  // onto [0, Pi/2) without a compare.
+  __m256d X = _mm256_min_pd(PosX, _mm256_sub_pd(_mm256_set1_pd(Pi64), PosX));
+
+  __m256d X2 = _mm256_mul_pd(X, X);
+
+  __m256d R = _mm256_set1_pd(0x1.883c1c5deffbep-49);
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(-0x1.ae43dc9bf8ba7p-41));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.6123ce513b09fp-33));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(-0x1.ae6454d960ac4p-26));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.71de3a52aab96p-19));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(-0x1.a01a01a014eb6p-13));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.11111111110c9p-7));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(-0x1.5555555555555p-3));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1p0));
+  R = _mm256_mul_pd(R, X);
+
+  __m256d Result = _mm256_or_pd(R, _mm256_and_pd(SignMask, OrigX));
+  return Result;
+}
+
+TARGET_AVX2 static __m256d CosCE_4x(__m256d X) {
+  __m256d Result = SinCE_4x(_mm256_add_pd(X, _mm256_set1_pd(Pi64 / 2.0)));
+  return Result;
+}
+
+TARGET_AVX2 static __m256d ASinCE_4x(__m256d OrigX) {
+  __m256d NeedsTransform =
+      _mm256_cmp_pd(OrigX, _mm256_set1_pd(0.7071067811865475244), _CMP_GT_OQ);
+  __m256d Transformed = _mm256_sqrt_pd(
+      _mm256_fnmadd_pd(OrigX, OrigX, _mm256_set1_pd(1.0)));
+  __m256d X = _mm256_blendv_pd(OrigX, Transformed, NeedsTransform);
+
+  __m256d X2 = _mm256_mul_pd(X, X);
+
+  __m256d R = _mm256_set1_pd(0x1.dfc53682725cap-1);
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(-0x1.bec6daf74ed61p1));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.8bf4dadaf548cp2));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(-0x1.b06f523e74f33p2));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.4537ddde2d76dp2));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(-0x1.6067d334b4792p1));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.1fb54da575b22p0));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(-0x1.57380bcd2890ep-2));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.69b370aad086ep-4));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(-0x1.21438ccc95d62p-8));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.b8a33b8e380efp-7));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.c37061f4e5f55p-7));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.1c875d6c5323dp-6));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.6e88ce94d1149p-6));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.f1c73443a02f5p-6));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.6db6db3184756p-5));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.3333333380df2p-4));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1.555555555531ep-3));
+  R = _mm256_fmadd_pd(R, X2, _mm256_set1_pd(0x1p0));
+  R = _mm256_mul_pd(R, X);
+
+  __m256d Result = _mm256_blendv_pd(
+      R, _mm256_sub_pd(_mm256_set1_pd(Pi64 / 2.0), R), NeedsTransform);
+  return Result;
+}
+
+TARGET_AVX2 static __m256d Haversine_4x(__m256d X0, __m256d Y0, __m256d X1,
+                                        __m256d Y1, __m256d EarthRadius) {
+  __m256d DegreesToRadians = _mm256_set1_pd(0.01745329251994329577);
+  __m256d Half = _mm256_set1_pd(0.5);
+
+  __m256d dLat = _mm256_mul_pd(DegreesToRadians, _mm256_sub_pd(Y1, Y0));
+  __m256d dLon = _mm256_mul_pd(DegreesToRadians, _mm256_sub_pd(X1, X0));
+  __m256d lat1 = _mm256_mul_pd(DegreesToRadians, Y0);
+  __m256d lat2 = _mm256_mul_pd(DegreesToRadians, Y1);
+
+  __m256d SinLat = SinCE_4x(_mm256_mul_pd(dLat, Half));
+  __m256d SinLon = SinCE_4x(_mm256_mul_pd(dLon, Half));
+  __m256d CosCos = _mm256_mul_pd(CosCE_4x(lat1), CosCE_4x(lat2));
+  __m256d a = _mm256_fmadd_pd(CosCos, _mm256_mul_pd(SinLon, SinLon),
+                              _mm256_mul_pd(SinLat, SinLat));
+  // NOTE: The approximations can overshoot 1 by an ulp, which would turn
+  // the asin transform's sqrt(1 - x*x) into a NaN.
+  a = _mm256_min_pd(a, _mm256_set1_pd(1.0));
+
+  __m256d c = _mm256_mul_pd(_mm256_set1_pd(2.0), ASinCE_4x(_mm256_sqrt_pd(a)));
+
+  __m256d Result = _mm256_mul_pd(EarthRadius, c);
+  return Result;
+}
+
+TARGET_AVX2 static f64 SumHaversineAVX2(std::span<f64 const> X0,
+                                        std::span<f64 const> Y0,
+                                        std::span<f64 const> X1,
+                                        std::span<f64 const> Y1,
+                                        f64 EarthRadius) {
+  constexpr u64 Width = 4;
+
+  __m256d Radius = _mm256_set1_pd(EarthRadius);
+  __m256d Sum = _mm256_setzero_pd();
+
+  u64 Count = X0.size();
+  u64 Index = 0;
+  for (; Index + Width <= Count; Index += Width) {
+    Sum = _mm256_add_pd(Sum, Haversine_4x(_mm256_loadu_pd(&X0[Index]),
+                                          _mm256_loadu_pd(&Y0[Index]),
+                                          _mm256_loadu_pd(&X1[Index]),
+                                          _mm256_loadu_pd(&Y1[Index]), Radius));
+  }
+
+  if (Index < Count) {
+    // NOTE: A pair of all-zero coordinates has a distance of exactly 0, so
+    // the tail can be zero-padded instead of masked.
+    f64 Tail[4][Width] = {};
+    for (u64 Lane = 0; Index + Lane < Count; ++Lane) {
+      Tail[0][Lane] = X0[Index + Lane];
+      Tail[1][Lane] = Y0[Index + Lane];
+      Tail[2][Lane] = X1[Index + Lane];
+      Tail[3][Lane] = Y1[Index + Lane];
+    }
+    Sum = _mm256_add_pd(Sum, Haversine_4x(_mm256_loadu_pd(Tail[0]),
+                                          _mm256_loadu_pd(Tail[1]),
+                                          _mm256_loadu_pd(Tail[2]),
+                                          _mm256_loadu_pd(Tail[3]), Radius));
+  }
+
+  f64 Lanes[Width];
+  _mm256_storeu_pd(Lanes, Sum);
+  f64 Result = (Lanes[0] + Lanes[1]) + (Lanes[2] + Lanes[3]);
+  return Result;
+}
+
+TARGET_AVX512 static __m512d SinCE_8x(__m512d OrigX) {
+  __m512d PosX = _mm512_abs_pd(OrigX);
+  __m512d X = _mm512_min_pd(PosX, _mm512_sub_pd(_mm512_set1_pd(Pi64), PosX));
+
+  __m512d X2 = _mm512_mul_pd(X, X);
+
+  __m512d R = _mm512_set1_pd(0x1.883c1c5deffbep-49);
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(-0x1.ae43dc9bf8ba7p-41));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.6123ce513b09fp-33));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(-0x1.ae6454d960ac4p-26));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.71de3a52aab96p-19));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(-0x1.a01a01a014eb6p-13));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.11111111110c9p-7));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(-0x1.5555555555555p-3));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1p0));
+  R = _mm512_mul_pd(R, X);
+
+  __m512i SignMask = _mm512_set1_epi64(static_cast<long long>(1ULL << 63));
+  __m512i Sign = _mm512_and_epi64(_mm512_castpd_si512(OrigX), SignMask);
+  __m512d Result =
+      _mm512_castsi512_pd(_mm512_or_epi64(_mm512_castpd_si512(R), Sign));
+  return Result;
+}
+
+TARGET_AVX512 static __m512d CosCE_8x(__m512d X) {
+  __m512d Result = SinCE_8x(_mm512_add_pd(X, _mm512_set1_pd(Pi64 / 2.0)));
+  return Result;
+}
+
+TARGET_AVX512 static __m512d ASinCE_8x(__m512d OrigX) {
+  __mmask8 NeedsTransform = _mm512_cmp_pd_mask(
+      OrigX, _mm512_set1_pd(0.7071067811865475244), _CMP_GT_OQ);
+  __m512d Transformed = _mm512_sqrt_pd(
+      _mm512_fnmadd_pd(OrigX, OrigX, _mm512_set1_pd(1.0)));
+  __m512d X = _mm512_mask_blend_pd(NeedsTransform, OrigX, Transformed);
+
+  __m512d X2 = _mm512_mul_pd(X, X);
+
+  __m512d R = _mm512_set1_pd(0x1.dfc53682725cap-1);
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(-0x1.bec6daf74ed61p1));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.8bf4dadaf548cp2));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(-0x1.b06f523e74f33p2));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.4537ddde2d76dp2));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(-0x1.6067d334b4792p1));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.1fb54da575b22p0));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(-0x1.57380bcd2890ep-2));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.69b370aad086ep-4));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(-0x1.21438ccc95d62p-8));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.b8a33b8e380efp-7));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.c37061f4e5f55p-7));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.1c875d6c5323dp-6));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.6e88ce94d1149p-6));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.f1c73443a02f5p-6));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.6db6db3184756p-5));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.3333333380df2p-4));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1.555555555531ep-3));
+  R = _mm512_fmadd_pd(R, X2, _mm512_set1_pd(0x1p0));
+  R = _mm512_mul_pd(R, X);
+
+  __m512d Result = _mm512_mask_sub_pd(R, NeedsTransform,
+                                      _mm512_set1_pd(Pi64 / 2.0), R);
+  return Result;
+}
+
+TARGET_AVX512 static __m512d Haversine_8x(__m512d X0, __m512d Y0, __m512d X1,
+                                          __m512d Y1, __m512d EarthRadius) {
+  __m512d DegreesToRadians = _mm512_set1_pd(0.01745329251994329577);
+  __m512d Half = _mm512_set1_pd(0.5);
+
+  __m512d dLat = _mm512_mul_pd(DegreesToRadians, _mm512_sub_pd(Y1, Y0));
+  __m512d dLon = _mm512_mul_pd(DegreesToRadians, _mm512_sub_pd(X1, X0));
+  __m512d lat1 = _mm512_mul_pd(DegreesToRadians, Y0);
+  __m512d lat2 = _mm512_mul_pd(DegreesToRadians, Y1);
+
+  __m512d SinLat = SinCE_8x(_mm512_mul_pd(dLat, Half));
+  __m512d SinLon = SinCE_8x(_mm512_mul_pd(dLon, Half));
+  __m512d CosCos = _mm512_mul_pd(CosCE_8x(lat1), CosCE_8x(lat2));
+  __m512d a = _mm512_fmadd_pd(CosCos, _mm512_mul_pd(SinLon, SinLon),
+                              _mm512_mul_pd(SinLat, SinLat));
+  a = _mm512_min_pd(a, _mm512_set1_pd(1.0));
+
+  __m512d c = _mm512_mul_pd(_mm512_set1_pd(2.0), ASinCE_8x(_mm512_sqrt_pd(a)));
+
+  __m512d Result = _mm512_mul_pd(EarthRadius, c);
+  return Result;
+}
+
+TARGET_AVX512 static f64 SumHaversineAVX512(std::span<f64 const> X0,
+                                            std::span<f64 const> Y0,
+                                            std::span<f64 const> X1,
+                                            std::span<f64 const> Y1,
+                                            f64 EarthRadius) {
+  constexpr u64 Width = 8;
+
+  __m512d Radius = _mm512_set1_pd(EarthRadius);
+  __m512d Sum = _mm512_setzero_pd();
+
+  u64 Count = X0.size();
+  u64 Index = 0;
+  for (; Index + Width <= Count; Index += Width) {
+    Sum = _mm512_add_pd(Sum, Haversine_8x(_mm512_loadu_pd(&X0[Index]),
+                                          _mm512_loadu_pd(&Y0[Index]),
+                                          _mm512_loadu_pd(&X1[Index]),
+                                          _mm512_loadu_pd(&Y1[Index]), Radius));
+  }
+
+  if (Index < Count) {
+    // NOTE: Masked-off lanes load as 0, and all-zero pairs contribute 0.
+    __mmask8 Mask = static_cast<__mmask8>((1u << (Count - Index)) - 1);
+    Sum = _mm512_add_pd(
+        Sum, Haversine_8x(_mm512_maskz_loadu_pd(Mask, &X0[Index]),
+                          _mm512_maskz_loadu_pd(Mask, &Y0[Index]),
+                          _mm512_maskz_loadu_pd(Mask, &X1[Index]),
+                          _mm512_maskz_loadu_pd(Mask, &Y1[Index]), Radius));
+  }
+
+  f64 Result = _mm512_reduce_add_pd(Sum);
+  return Result;
+}
+
+struct cpu_features {
+  bool AVX2;
+  bool AVX512;
+};
+
+static void CPUID(u32 Leaf, u32 SubLeaf, u32 Registers[4]) {
+#if _WIN32
+  int Result[4];
+  __cpuidex(Result, static_cast<int>(Leaf), static_cast<int>(SubLeaf));
+  for (int Index = 0; Index < 4; ++Index) {
+    Registers[Index] = static_cast<u32>(Result[Index]);
+  }
+#else
+  __cpuid_count(Leaf, SubLeaf, Registers[0], Registers[1], Registers[2],
+                Registers[3]);
+#endif
+}
+
+static u64 ReadXCR0() {
+#if _WIN32
+  return _xgetbv(0);
+#else
+  u32 Low, High;
+  __asm__ volatile("xgetbv" : "=a"(Low), "=d"(High) : "c"(0));
+  return (static_cast<u64>(High) << 32) | Low;
+#endif
+}
+
+static cpu_features DetectCPUFeatures() {
+  cpu_features Features = {};
+
+  u32 Registers[4];
+  CPUID(0, 0, Registers);
+  u32 MaxLeaf = Registers[0];
+  if (MaxLeaf < 7) {
+    return Features;
+  }
+
+  CPUID(1, 0, Registers);
+  bool FMA = Registers[2] & (1u << 12);
+  bool OSXSAVE = Registers[2] & (1u << 27);
+  bool AVX = Registers[2] & (1u << 28);
+  if (!OSXSAVE || !AVX || !FMA) {
+    return Features;
+  }
+
+  // NOTE: The CPU supporting AVX isn't enough - the OS also has to save the
+  // YMM (bits 1-2) and, for AVX-512, opmask/ZMM (bits 5-7) state.
+  u64 XCR0 = ReadXCR0();
+  bool OSSavesYMM = (XCR0 & 0x6) == 0x6;
+  bool OSSavesZMM = (XCR0 & 0xe6) == 0xe6;
+
+  CPUID(7, 0, Registers);
+  Features.AVX2 = OSSavesYMM && (Registers[1] & (1u << 5));
+  Features.AVX512 = OSSavesZMM && (Registers[1] & (1u << 16));
+  return Features;
+}
+
+static cpu_features const &GetCPUFeatures() {
+  static cpu_features const Features = DetectCPUFeatures();
+  return Features;
+}
+
+haversine_kernel GetBestHaversineKernel() {
+  static haversine_kernel const Kernel =
+      GetCPUFeatures().AVX512 ? haversine_kernel::AVX512
+      : GetCPUFeatures().AVX2 ? haversine_kernel::AVX2
+                              : haversine_kernel::Reference;
+  return Kernel;
+}
+
+bool IsHaversineKernelSupported(haversine_kernel Kernel) {
+  switch (Kernel) {
+  case haversine_kernel::Reference: {
+    return true;
+  }
+  case haversine_kernel::AVX2: {
+    return GetCPUFeatures().AVX2;
+  }
+  case haversine_kernel::AVX512: {
+    return GetCPUFeatures().AVX512;
+  }
+  default:
+    return false;
+  }
+}
+
+char const *GetHaversineKernelName(haversine_kernel Kernel) {
+  switch (Kernel) {
+  case haversine_kernel::Reference: {
+    return "reference";
+  }
+  case haversine_kernel::AVX2: {
+    return "avx2";
+  }
+  case haversine_kernel::AVX512: {
+    return "avx512";
+  }
+  default:
+    return "unknown";
+  }
+}
+
+f64 SumHaversine(std::span<f64 const> X0, std::span<f64 const> Y0,
+                 std::span<f64 const> X1, std::span<f64 const> Y1,
+                 f64 EarthRadius, haversine_kernel Kernel) {
+  u64 Count = std::min({X0.size(), Y0.size(), X1.size(), Y1.size()});
+  X0 = X0.first(Count);
+  Y0 = Y0.first(Count);
+  X1 = X1.first(Count);
+  Y1 = Y1.first(Count);
+
+  if (!IsHaversineKernelSupported(Kernel)) {
+    Kernel = haversine_kernel::Reference;
+  }
+
+  switch (Kernel) {
+  case haversine_kernel::AVX2: {
+    return SumHaversineAVX2(X0, Y0, X1, Y1, EarthRadius);
+  }
+  case haversine_kernel::AVX512: {
+    return SumHaversineAVX512(X0, Y0, X1, Y1, EarthRadius);
+  }
+  default:
+    return SumHaversineReference(X0, Y0, X1, Y1, EarthRadius);
+  }
+}
@@ -1,3 +1,31 @@
+#pragma once
+
 #include "types.hpp"
 
+#include <span>
+
+enum class haversine_kernel {
+  Reference,
+  AVX2,
+  AVX512,
+
+  Count,
+};
+
 f64 ReferenceHaversine(f64 X0, f64 Y0, f64 X1, f64 Y1, f64 EarthRadius);
+
+// Widest kernel both the CPU and the OS support, detected once via CPUID.
+haversine_kernel GetBestHaversineKernel();
+bool IsHaversineKernelSupported(haversine_kernel Kernel);
+char const *GetHaversineKernelName(haversine_kernel Kernel);
+
+// Sums the haversine distance over structure-of-arrays input, one span per
+// coordinate. The Reference kernel calls ReferenceHaversine in fixed-size
+// blocks and adds the distances in pair order, so it matches a plain loop
+// exactly. The AVX2 (4-wide) and AVX512 (8-wide) kernels replace libm with
+// the minimax polynomials from the course and accumulate per lane, so they
+// agree with Reference only to within rounding.
+f64 SumHaversine(std::span<f64 const> X0, std::span<f64 const> Y0,
+                 std::span<f64 const> X1, std::span<f64 const> Y1,
+                 f64 EarthRadius,
+                 haversine_kernel Kernel = GetBestHaversineKernel());
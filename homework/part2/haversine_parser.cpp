@@ -1,24 +1,37 @@
 #include "haversine_parser.hpp"
 
+#include "float_parser.hpp"
 #include "haversine_math.hpp"
 #include "types.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cctype>
 #include <cstddef>
 #include <cstdint>
-#include <cstdlib>
-#include <filesystem>
-#include <fstream>
-#include <ios>
+#include <cstring>
 #include <iostream>
-#include <map>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
-#include <variant>
+#include <thread>
 #include <vector>
 
-JsonTokenizer::JsonTokenizer(std::string_view sv) : m_src{sv}, m_pos{0} {}
+#include <emmintrin.h>
+
+static f64 ParseNumber(std::string_view number) {
+  f64 value;
+  if (!parseF64(number, value)) {
+    throw std::runtime_error{"Invalid number: " + std::string{number}};
+  }
+  return value;
+}
+
+JsonTokenizer::JsonTokenizer(std::string_view sv)
+    : m_src{sv}, m_pos{0}, m_block{std::string_view::npos}, m_space{0},
+      m_quote{0}, m_structural{0} {}
 
 json_token JsonTokenizer::next() {
   _skip_ws();
@@ -77,10 +90,86 @@ json_token JsonTokenizer::next() {
   throw std::runtime_error{"Unexpected token type"};
 }
 
+size_t JsonTokenizer::position() const { return m_pos; }
+
+void JsonTokenizer::_index_block(size_t block) {
+  if (block == m_block) {
+    return;
+  }
+
+  char const *bytes = m_src.data() + block;
+  char padded[64];
+  if (m_src.size() - block < sizeof(padded)) {
+    // NOTE: Bytes past the end read as whitespace, which ends a number and
+    // never matches a quote; _scan stops at m_src.size() anyway.
+    std::memset(padded, ' ', sizeof(padded));
+    std::memcpy(padded, bytes, m_src.size() - block);
+    bytes = padded;
+  }
+
+  auto splat = [](char c) { return _mm_set1_epi8(c); };
+  u64 space = 0;
+  u64 quote = 0;
+  u64 structural = 0;
+  for (u32 chunk = 0; chunk < 4; chunk++) {
+    __m128i v = _mm_loadu_si128(
+        reinterpret_cast<__m128i const *>(bytes + 16 * chunk));
+
+    __m128i s = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, splat(' ')),
+                     _mm_cmpeq_epi8(v, splat('\t'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, splat('\n')),
+                     _mm_cmpeq_epi8(v, splat('\r'))));
+    __m128i q = _mm_cmpeq_epi8(v, splat('"'));
+    // NOTE: '[' ']' and '{' '}' differ only in bit 5, so clearing it lets
+    // one compare catch both of a pair.
+    __m128i folded = _mm_andnot_si128(splat(0x20), v);
+    __m128i o = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(folded, splat('[')),
+                     _mm_cmpeq_epi8(folded, splat(']'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, splat(':')),
+                     _mm_cmpeq_epi8(v, splat(','))));
+
+    u32 shift = 16 * chunk;
+    space |= static_cast<u64>(static_cast<u32>(_mm_movemask_epi8(s))) << shift;
+    quote |= static_cast<u64>(static_cast<u32>(_mm_movemask_epi8(q))) << shift;
+    structural |= static_cast<u64>(static_cast<u32>(_mm_movemask_epi8(o)))
+                  << shift;
+  }
+
+  m_block = block;
+  m_space = space;
+  m_quote = quote;
+  m_structural = structural;
+}
+
+// Returns the first position at or after pos whose bit is set in the mask
+// produced by select, or m_src.size() if there is none.
+template <typename Select>
+size_t JsonTokenizer::_scan(size_t pos, Select select) {
+  while (pos < m_src.size()) {
+    size_t block = pos & ~size_t{63};
+    _index_block(block);
+
+    u64 bits = select() >> (pos - block);
+    if (bits) {
+      return std::min(pos + std::countr_zero(bits), m_src.size());
+    }
+    pos = block + 64;
+  }
+  return m_src.size();
+}
+
 void JsonTokenizer::_skip_ws() {
-  while (m_pos < m_src.size() && std::isspace(static_cast<int>(m_src[m_pos]))) {
-    m_pos++;
+  // NOTE: Most tokens follow the previous one directly, and the bitmask of a
+  // block that has already been indexed answers that without touching the
+  // byte; only a real run of whitespace needs the scan. Before the first
+  // block is indexed m_space is empty and says nothing, so that case scans.
+  if (m_block != std::string_view::npos && m_pos - m_block < 64 &&
+      !((m_space >> (m_pos - m_block)) & 1)) {
+    return;
   }
+  m_pos = _scan(m_pos, [this] { return ~m_space; });
 }
 
 json_token JsonTokenizer::_simple(json_token_type type) {
@@ -92,10 +181,8 @@ json_token JsonTokenizer::_simple(json_token_type type) {
 json_token JsonTokenizer::_string() {
   m_pos++;
   auto start = m_pos;
-  while (m_pos < m_src.size() && m_src[m_pos] != '\"') {
-    m_pos++;
-  }
-  if (m_pos > m_src.size()) {
+  m_pos = _scan(m_pos, [this] { return m_quote; });
+  if (m_pos >= m_src.size()) {
     throw std::runtime_error{"Unterminated string"};
   }
 
@@ -106,43 +193,98 @@ json_token JsonTokenizer::_string() {
 
 json_token JsonTokenizer::_number() {
   auto start = m_pos;
+  m_pos = _scan(m_pos, [this] { return m_space | m_structural | m_quote; });
+  return json_token{json_token_type::Number,
+                    m_src.substr(start, m_pos - start)};
+}
+
+bool JsonTokenizer::_starts_with(std::string_view sv) {
+  return m_src.substr(m_pos, sv.size()) == sv;
+}
 
-  if (m_src[m_pos] == '-') {
-    m_pos++;
+static u32 CheckedSize(size_t size) {
+  if (size > UINT32_MAX) {
+    throw std::runtime_error{"JSON container too large"};
   }
+  return static_cast<u32>(size);
+}
+
+static JsonValue MakeValue(json_value_type type, u32 size = 0) {
+  JsonValue value{};
+  value.type = type;
+  value.size = size;
+  return value;
+}
+
+bool JsonValue::is_null() const { return type == json_value_type::Null; }
 
-  while (m_pos < m_src.size() &&
-         std::isdigit(static_cast<unsigned int>(m_src[m_pos]))) {
-    m_pos++;
+bool JsonValue::as_bool() const {
+  if (type != json_value_type::Bool) {
+    throw std::runtime_error{"Expected bool"};
   }
+  return boolean;
+}
 
-  if (m_src[m_pos] == '.') {
-    m_pos++;
+f64 JsonValue::as_number() const {
+  if (type != json_value_type::Number) {
+    throw std::runtime_error{"Expected number"};
   }
+  return number;
+}
 
-  while (m_pos < m_src.size() &&
-         std::isdigit(static_cast<unsigned int>(m_src[m_pos]))) {
-    m_pos++;
+std::string_view JsonValue::as_string() const {
+  if (type != json_value_type::String) {
+    throw std::runtime_error{"Expected string"};
   }
+  return {string, size};
+}
 
-  return json_token{json_token_type::Number,
-                    m_src.substr(start, m_pos - start)};
+std::span<JsonValue const> JsonValue::as_array() const {
+  if (type != json_value_type::Array) {
+    throw std::runtime_error{"Expected array"};
+  }
+  return {elements, size};
 }
 
-bool JsonTokenizer::_starts_with(std::string_view sv) {
-  return m_src.substr(m_pos, sv.size()) == sv;
+std::span<JsonMember const> JsonValue::as_object() const {
+  if (type != json_value_type::Object) {
+    throw std::runtime_error{"Expected object"};
+  }
+  return {members, size};
 }
 
+JsonValue const *JsonValue::find(std::string_view key) const {
+  for (auto const &member : as_object()) {
+    if (member.key == key) {
+      return &member.value;
+    }
+  }
+  return nullptr;
+}
+
+JsonValue const &JsonValue::operator[](std::string_view key) const {
+  auto value = find(key);
+  if (!value) {
+    throw std::runtime_error{"Missing key " + std::string{key}};
+  }
+  return *value;
+}
+
+JsonDocument::JsonDocument(Arena arena, JsonValue root)
+    : m_arena{std::move(arena)}, m_root{root} {}
+
+JsonValue const &JsonDocument::root() const { return m_root; }
+
 JsonParser::JsonParser(JsonTokenizer tokenizer)
     : m_tokenizer{std::move(tokenizer)}, m_token{m_tokenizer.next()} {}
 
-JsonValue JsonParser::parse() {
+JsonDocument JsonParser::parse() {
   auto value = _value();
   m_token = m_tokenizer.next();
   if (m_token.type != json_token_type::End) {
     throw std::runtime_error{"Expected end of file"};
   }
-  return value;
+  return JsonDocument{std::move(m_arena), value};
 }
 
 JsonValue JsonParser::_value() {
@@ -154,19 +296,22 @@ JsonValue JsonParser::_value() {
     return _array();
   }
   case json_token_type::String_literal: {
-    return std::string_view{};
+    auto value = MakeValue(json_value_type::String,
+                           CheckedSize(m_token.value.size()));
+    value.string = m_token.value.data();
+    return value;
   }
   case json_token_type::Number: {
     return _number();
   }
-  case json_token_type::True: {
-    return true;
-  }
+  case json_token_type::True:
   case json_token_type::False: {
-    return false;
+    auto value = MakeValue(json_value_type::Bool);
+    value.boolean = m_token.type == json_token_type::True;
+    return value;
   }
   case json_token_type::Null: {
-    return nullptr;
+    return MakeValue(json_value_type::Null);
   }
   default:
     throw std::runtime_error{"Unexpected token type"};
@@ -174,82 +319,433 @@ JsonValue JsonParser::_value() {
 }
 
 JsonValue JsonParser::_object() {
-  JsonObject object{};
-  std::string key;
+  auto first = m_members.size();
+  m_token = m_tokenizer.next();
+  if (m_token.type != json_token_type::Close_brace) {
+    for (;; m_token = m_tokenizer.next()) {
+      if (m_token.type == json_token_type::End) {
+        throw std::runtime_error{"Incorrect json object"};
+      } else if (m_token.type != json_token_type::String_literal) {
+        throw std::runtime_error{"Expected key"};
+      }
+      auto key = m_token.value;
+
+      if (m_tokenizer.next().type != json_token_type::Colon) {
+        throw std::runtime_error{"Expected colon"};
+      }
+
+      m_token = m_tokenizer.next();
+      auto value = _value();
+      m_members.push_back(JsonMember{key, value});
+
+      m_token = m_tokenizer.next();
+      if (m_token.type == json_token_type::Close_brace) {
+        break;
+      } else if (m_token.type != json_token_type::Comma) {
+        throw std::runtime_error{"Expected comma"};
+      }
+    }
+  }
+
+  auto count = m_members.size() - first;
+  auto object = MakeValue(json_value_type::Object, CheckedSize(count));
+  auto members = m_arena.allocate<JsonMember>(count);
+  std::copy(m_members.begin() + first, m_members.end(), members);
+  m_members.resize(first);
+  object.members = members;
+  return object;
+}
+
+JsonValue JsonParser::_array() {
+  auto first = m_elements.size();
+  m_token = m_tokenizer.next();
+  if (m_token.type != json_token_type::Close_bracket) {
+    for (;; m_token = m_tokenizer.next()) {
+      if (m_token.type == json_token_type::End) {
+        throw std::runtime_error{"Incorrect json array"};
+      }
+      auto value = _value();
+      m_elements.push_back(value);
+
+      m_token = m_tokenizer.next();
+      if (m_token.type == json_token_type::Close_bracket) {
+        break;
+      } else if (m_token.type != json_token_type::Comma) {
+        throw std::runtime_error{"Expected comma"};
+      }
+    }
+  }
+
+  auto count = m_elements.size() - first;
+  auto array = MakeValue(json_value_type::Array, CheckedSize(count));
+  auto elements = m_arena.allocate<JsonValue>(count);
+  std::copy(m_elements.begin() + first, m_elements.end(), elements);
+  m_elements.resize(first);
+  array.elements = elements;
+  return array;
+}
+
+JsonValue JsonParser::_number() {
+  auto value = MakeValue(json_value_type::Number);
+  value.number = ParseNumber(m_token.value);
+  return value;
+}
+
+u64 haversine_pairs::size() const { return x0.size(); }
+
+void haversine_pairs::reserve(u64 count) {
+  x0.reserve(count);
+  y0.reserve(count);
+  x1.reserve(count);
+  y1.reserve(count);
+}
+
+void haversine_pairs::push_back(haversine_pair const &pair) {
+  x0.push_back(pair.x0);
+  y0.push_back(pair.y0);
+  x1.push_back(pair.x1);
+  y1.push_back(pair.y1);
+}
+
+u64 haversine_pairs_view::size() const { return x0.size(); }
+
+HaversinePairReader::HaversinePairReader(JsonTokenizer tokenizer,
+                                         pair_reader_mode mode)
+    : m_tokenizer{std::move(tokenizer)}, m_token{json_token_type::End, ""},
+      m_mode{mode}, m_count{0}, m_done{false} {
+  if (m_mode == pair_reader_mode::Fragment) {
+    return;
+  }
+
+  m_token = m_tokenizer.next();
+  _expect(json_token_type::Open_brace, "Expected object");
+
   for (m_token = m_tokenizer.next(); m_token.type != json_token_type::End;
        m_token = m_tokenizer.next()) {
-    key = m_token.value;
+    _expect(json_token_type::String_literal, "Expected key");
+    auto key = m_token.value;
 
     if (m_tokenizer.next().type != json_token_type::Colon) {
       throw std::runtime_error{"Expected colon"};
     }
 
     m_token = m_tokenizer.next();
-    auto value = _value();
-    object[key] = value;
+    if (key == "pairs") {
+      _expect(json_token_type::Open_bracket, "Expected pairs array");
+      return;
+    }
+    _skip_value();
 
     m_token = m_tokenizer.next();
     if (m_token.type == json_token_type::Close_brace) {
-      return object;
+      break;
     } else if (m_token.type != json_token_type::Comma) {
       throw std::runtime_error{"Expected comma"};
     }
   }
 
-  throw std::runtime_error{"Incorrect json object"};
+  throw std::runtime_error{"Missing pairs array"};
 }
 
-JsonValue JsonParser::_array() {
-  JsonArray array{};
+bool HaversinePairReader::next(haversine_pair &pair) {
+  if (m_done) {
+    return false;
+  }
+
+  m_token = m_tokenizer.next();
+  if (m_mode == pair_reader_mode::Fragment) {
+    if (m_count && m_token.type != json_token_type::End) {
+      _expect(json_token_type::Comma, "Expected comma");
+      m_token = m_tokenizer.next();
+    }
+    if (m_token.type == json_token_type::End) {
+      m_done = true;
+      return false;
+    }
+  } else {
+    if (m_token.type == json_token_type::Close_bracket) {
+      _finish();
+      return false;
+    }
+
+    if (m_count) {
+      _expect(json_token_type::Comma, "Expected comma");
+      m_token = m_tokenizer.next();
+    }
+  }
+
+  _pair(pair);
+  m_count++;
+  return true;
+}
+
+u64 HaversinePairReader::count() const { return m_count; }
+
+size_t HaversinePairReader::position() const { return m_tokenizer.position(); }
+
+void HaversinePairReader::_pair(haversine_pair &pair) {
+  _expect(json_token_type::Open_brace, "Expected pair object");
+
+  u32 seen = 0;
   for (m_token = m_tokenizer.next(); m_token.type != json_token_type::End;
        m_token = m_tokenizer.next()) {
-    auto value = _value();
-    array.push_back(value);
+    _expect(json_token_type::String_literal, "Expected key");
+    auto key = m_token.value;
+
+    if (m_tokenizer.next().type != json_token_type::Colon) {
+      throw std::runtime_error{"Expected colon"};
+    }
 
     m_token = m_tokenizer.next();
-    if (m_token.type == json_token_type::Close_bracket) {
-      return array;
+    f64 *coordinate = nullptr;
+    u32 bit = 0;
+    if (key == "x0") {
+      coordinate = &pair.x0;
+      bit = 1;
+    } else if (key == "y0") {
+      coordinate = &pair.y0;
+      bit = 2;
+    } else if (key == "x1") {
+      coordinate = &pair.x1;
+      bit = 4;
+    } else if (key == "y1") {
+      coordinate = &pair.y1;
+      bit = 8;
+    }
+
+    if (coordinate) {
+      _expect(json_token_type::Number, "Expected number");
+      *coordinate = ParseNumber(m_token.value);
+      seen |= bit;
+    } else {
+      _skip_value();
+    }
+
+    m_token = m_tokenizer.next();
+    if (m_token.type == json_token_type::Close_brace) {
+      if (seen != 0xF) {
+        throw std::runtime_error{"Incomplete pair"};
+      }
+      return;
     } else if (m_token.type != json_token_type::Comma) {
       throw std::runtime_error{"Expected comma"};
     }
   }
 
-  throw std::runtime_error{"Incorrect json array"};
+  throw std::runtime_error{"Incorrect json object"};
 }
 
-JsonValue JsonParser::_number() {
-  auto value = std::strtod(m_token.value.data(), nullptr);
-  return value;
+void HaversinePairReader::_skip_value() {
+  u64 depth = 0;
+  do {
+    switch (m_token.type) {
+    case json_token_type::Open_brace:
+    case json_token_type::Open_bracket: {
+      depth++;
+      break;
+    }
+    case json_token_type::Close_brace:
+    case json_token_type::Close_bracket: {
+      if (!depth) {
+        throw std::runtime_error{"Unexpected token type"};
+      }
+      depth--;
+      break;
+    }
+    case json_token_type::End: {
+      throw std::runtime_error{"Unexpected end of file"};
+    }
+    default:
+      break;
+    }
+
+    if (depth) {
+      m_token = m_tokenizer.next();
+    }
+  } while (depth);
 }
 
-std::string read_file(std::filesystem::path const &path) {
-  std::ifstream fp(path, std::ios::in | std::ios::binary);
-  std::stringstream buffer;
-  buffer << fp.rdbuf();
-  return buffer.str();
+void HaversinePairReader::_finish() {
+  for (m_token = m_tokenizer.next(); m_token.type == json_token_type::Comma;
+       m_token = m_tokenizer.next()) {
+    m_token = m_tokenizer.next();
+    _expect(json_token_type::String_literal, "Expected key");
+    if (m_tokenizer.next().type != json_token_type::Colon) {
+      throw std::runtime_error{"Expected colon"};
+    }
+    m_token = m_tokenizer.next();
+    _skip_value();
+  }
+
+  _expect(json_token_type::Close_brace, "Expected end of object");
+  if (m_tokenizer.next().type != json_token_type::End) {
+    throw std::runtime_error{"Expected end of file"};
+  }
+  m_done = true;
 }
 
-u64 getPairCount(JsonValue data) {
-  auto object = std::get<JsonObject>(data);
-  auto pairs = std::get<JsonArray>(object["pairs"]);
-  return pairs.size();
+void HaversinePairReader::_expect(json_token_type type, char const *message) {
+  if (m_token.type != type) {
+    throw std::runtime_error{message};
+  }
 }
 
-f64 sumHaversineDistances(u64 PairCount, JsonValue data) {
-  auto object = std::get<JsonObject>(data);
-  auto pairs = std::get<JsonArray>(object["pairs"]);
+u64 getPairCount(JsonValue const &data) {
+  return data["pairs"].as_array().size();
+}
 
+f64 sumHaversineDistances(u64 PairCount, JsonValue const &data) {
   f64 EarthRadius = 6372.8;
   f64 sum = 0;
-  for (auto const &pair : pairs) {
-    auto values = std::get<JsonObject>(pair);
-    auto x0 = std::get<double>(values.at("x0"));
-    auto y0 = std::get<double>(values.at("y0"));
-    auto x1 = std::get<double>(values.at("x1"));
-    auto y1 = std::get<double>(values.at("y1"));
+  for (auto const &pair : data["pairs"].as_array()) {
+    auto x0 = pair["x0"].as_number();
+    auto y0 = pair["y0"].as_number();
+    auto x1 = pair["x1"].as_number();
+    auto y1 = pair["y1"].as_number();
     f64 dis = ReferenceHaversine(x0, y0, x1, y1, EarthRadius);
     sum += dis;
   }
   sum /= PairCount;
   return sum;
 }
+
+haversine_sum streamHaversineDistances(JsonTokenizer tokenizer) {
+  HaversinePairReader reader{std::move(tokenizer)};
+
+  f64 EarthRadius = 6372.8;
+  f64 sum = 0;
+  haversine_pair pair;
+  while (reader.next(pair)) {
+    f64 dis = ReferenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1,
+                                 EarthRadius);
+    sum += dis;
+  }
+
+  u64 pairCount = reader.count();
+  sum /= pairCount;
+  return haversine_sum{pairCount, sum};
+}
+
+haversine_pairs readHaversinePairs(JsonTokenizer tokenizer) {
+  HaversinePairReader reader{std::move(tokenizer)};
+
+  haversine_pairs pairs;
+  haversine_pair pair;
+  while (reader.next(pair)) {
+    pairs.push_back(pair);
+  }
+  return pairs;
+}
+
+haversine_pairs readHaversinePairsParallel(std::string_view input,
+                                           u32 threadCount) {
+  // NOTE: Below this much input per thread, spawning costs more than it saves.
+  constexpr u64 MinRangeSize = 1 << 20;
+  constexpr std::string_view whitespace = " \t\r\n";
+
+  HaversinePairReader reader{JsonTokenizer{input}};
+  u64 begin = reader.position();
+  u64 end = input.rfind(']');
+  bool splittable = end != std::string_view::npos && end >= begin;
+  if (splittable) {
+    auto after = input.substr(end + 1);
+    auto closing = after.find_first_not_of(whitespace);
+    auto last = input.find_last_not_of(whitespace, end - 1);
+    splittable = closing != std::string_view::npos && after[closing] == '}' &&
+                 after.find_first_not_of(whitespace, closing + 1) ==
+                     std::string_view::npos &&
+                 (input[last] == '}' || last + 1 == begin);
+  }
+
+  u64 maxThreads = splittable ? (end - begin) / MinRangeSize + 1 : 1;
+  if (threadCount < 2 || maxThreads < 2) {
+    return readHaversinePairs(JsonTokenizer{input});
+  }
+  threadCount = static_cast<u32>(std::min<u64>(threadCount, maxThreads));
+
+  // NOTE: Pair objects are flat, so the first '{' at or after a split point is
+  // always the start of a pair.
+  std::vector<u64> starts(threadCount + 1);
+  starts[0] = begin;
+  starts[threadCount] = end;
+  for (u32 index = 1; index < threadCount; index++) {
+    u64 split = begin + (end - begin) * index / threadCount;
+    split = std::min(input.find('{', std::max(split, starts[index - 1])), end);
+    starts[index] = split;
+  }
+
+  std::vector<haversine_pairs> parts(threadCount);
+  std::atomic<bool> failed = false;
+  auto runOnThreads = [&](auto &&work) {
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount);
+    for (u32 index = 0; index < threadCount; index++) {
+      threads.emplace_back([&, index] {
+        try {
+          work(index);
+        } catch (std::exception const &) {
+          // NOTE: Not just parse errors: a bad_alloc from a chunk's vectors
+          // would terminate the program if it escaped the thread.
+          failed = true;
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  };
+
+  runOnThreads([&](u32 index) {
+    auto range = input.substr(starts[index], starts[index + 1] - starts[index]);
+    HaversinePairReader fragment{JsonTokenizer{range},
+                                 pair_reader_mode::Fragment};
+    haversine_pair pair;
+    while (fragment.next(pair)) {
+      parts[index].push_back(pair);
+    }
+  });
+
+  // NOTE: The layout check above can't rule out everything (a later key
+  // holding an array of objects, say). Let the serial parser either handle
+  // the document or report the real error.
+  if (failed) {
+    return readHaversinePairs(JsonTokenizer{input});
+  }
+
+  std::vector<u64> offsets(threadCount + 1);
+  for (u32 index = 0; index < threadCount; index++) {
+    offsets[index + 1] = offsets[index] + parts[index].size();
+  }
+
+  haversine_pairs pairs;
+  pairs.x0.resize(offsets[threadCount]);
+  pairs.y0.resize(offsets[threadCount]);
+  pairs.x1.resize(offsets[threadCount]);
+  pairs.y1.resize(offsets[threadCount]);
+  runOnThreads([&](u32 index) {
+    auto &part = parts[index];
+    auto offset = offsets[index];
+    std::ranges::copy(part.x0, pairs.x0.begin() + offset);
+    std::ranges::copy(part.y0, pairs.y0.begin() + offset);
+    std::ranges::copy(part.x1, pairs.x1.begin() + offset);
+    std::ranges::copy(part.y1, pairs.y1.begin() + offset);
+    part = haversine_pairs{};
+  });
+
+  return pairs;
+}
+
+f64 sumHaversineDistances(haversine_pairs const &pairs,
+                          haversine_kernel kernel) {
+  return sumHaversineDistances(
+      haversine_pairs_view{pairs.x0, pairs.y0, pairs.x1, pairs.y1}, kernel);
+}
+
+f64 sumHaversineDistances(haversine_pairs_view pairs,
+                          haversine_kernel kernel) {
+  f64 EarthRadius = 6372.8;
+  f64 sum = SumHaversine(pairs.x0, pairs.y0, pairs.x1, pairs.y1, EarthRadius,
+                         kernel);
+  sum /= pairs.size();
+  return sum;
+}
@@ -1,10 +1,13 @@
+#pragma once
+
+#include "arena.hpp"
+#include "haversine_math.hpp"
+#include "input_file.hpp"
 #include "types.hpp"
 
-#include <filesystem>
-#include <map>
+#include <span>
 #include <string>
 #include <string_view>
-#include <variant>
 #include <vector>
 
 enum class json_token_type {
@@ -31,15 +34,61 @@ struct json_token {
   std::string_view value;
 };
 
-struct JsonValue;
+enum class json_value_type : u32 {
+  Null,
+  Bool,
+  Number,
+  String,
+  Array,
+  Object,
+};
 
-using JsonObject = std::map<std::string, JsonValue>;
-using JsonArray = std::vector<JsonValue>;
+struct JsonMember;
+
+// Node of a parsed document. Arrays and objects point at contiguous runs of
+// children in the document's arena, objects as flat key/value arrays searched
+// linearly, and strings and keys are views into the source buffer, so a
+// JsonValue is only valid while both its JsonDocument and the input are.
+struct JsonValue {
+  json_value_type type;
+  u32 size; // string length, element or member count
+  union {
+    bool boolean;
+    f64 number;
+    char const *string;
+    JsonValue const *elements;
+    JsonMember const *members;
+  };
+
+  bool is_null() const;
+  bool as_bool() const;
+  f64 as_number() const;
+  std::string_view as_string() const;
+  std::span<JsonValue const> as_array() const;
+  std::span<JsonMember const> as_object() const;
+
+  // Object member lookup; find returns nullptr and operator[] throws when the
+  // key is missing.
+  JsonValue const *find(std::string_view key) const;
+  JsonValue const &operator[](std::string_view key) const;
+};
 
-struct JsonValue
-    : public std::variant<std::nullptr_t, bool, double, std::string_view,
-                          JsonArray, JsonObject> {
-  using variant::variant;
+struct JsonMember {
+  std::string_view key;
+  JsonValue value;
+};
+
+// Owns the arena every node of a parsed tree lives in. Destroying the
+// document frees the whole tree in one go.
+class JsonDocument {
+public:
+  JsonDocument(Arena arena, JsonValue root);
+
+  JsonValue const &root() const;
+
+private:
+  Arena m_arena;
+  JsonValue m_root;
 };
 
 class JsonTokenizer {
@@ -47,26 +96,45 @@ public:
   explicit JsonTokenizer(std::string_view sv);
 
   json_token next();
+  size_t position() const;
 
 private:
   std::string_view m_src;
   size_t m_pos;
 
+  // NOTE: Character-class bitmasks for the 64-byte block of m_src starting at
+  // m_block, built with SIMD compares (bit i describes byte m_block + i).
+  // Scanning for the next token boundary is then a shift and a bit scan
+  // instead of a byte loop.
+  size_t m_block;
+  u64 m_space;
+  u64 m_quote;
+  u64 m_structural;
+
   void _skip_ws();
   json_token _simple(json_token_type type);
   json_token _string();
   json_token _number();
   bool _starts_with(std::string_view sv);
+  void _index_block(size_t block);
+  template <typename Select> size_t _scan(size_t pos, Select select);
 };
 
 class JsonParser {
   JsonTokenizer m_tokenizer;
   json_token m_token;
+  Arena m_arena;
+
+  // NOTE: Children of the arrays and objects currently being parsed. A
+  // container's children are copied into the arena in one block when it
+  // closes, so the arena only ever holds finished nodes.
+  std::vector<JsonValue> m_elements;
+  std::vector<JsonMember> m_members;
 
 public:
   JsonParser(JsonTokenizer tokenizer);
 
-  JsonValue parse();
+  JsonDocument parse();
 
 private:
   JsonValue _value();
@@ -75,6 +143,91 @@ private:
   JsonValue _number();
 };
 
-std::string read_file(std::filesystem::path const &path);
-u64 getPairCount(JsonValue data);
-f64 sumHaversineDistances(u64 PairCount, JsonValue data);
+struct haversine_pair {
+  f64 x0;
+  f64 y0;
+  f64 x1;
+  f64 y1;
+};
+
+// Pulls pairs out of a {"pairs":[...]} document one at a time, straight from
+// the token stream, without building a JsonValue tree. Keys other than
+// "pairs" at the top level, and other than x0/y0/x1/y1 inside a pair, are
+// skipped.
+//
+// In Fragment mode the input is a slice of the pairs array body instead: a
+// comma-separated run of pair objects that may end in one trailing comma.
+// This is what each thread of readHaversinePairsParallel sees.
+enum class pair_reader_mode {
+  Document,
+  Fragment,
+};
+
+class HaversinePairReader {
+  JsonTokenizer m_tokenizer;
+  json_token m_token;
+  pair_reader_mode m_mode;
+  u64 m_count;
+  bool m_done;
+
+public:
+  explicit HaversinePairReader(
+      JsonTokenizer tokenizer,
+      pair_reader_mode mode = pair_reader_mode::Document);
+
+  bool next(haversine_pair &pair);
+  u64 count() const;
+  size_t position() const;
+
+private:
+  void _pair(haversine_pair &pair);
+  void _skip_value();
+  void _finish();
+  void _expect(json_token_type type, char const *message);
+};
+
+// Structure-of-arrays pair storage: each coordinate lives in its own
+// contiguous array so SumHaversine can stream through them.
+struct haversine_pairs {
+  std::vector<f64> x0;
+  std::vector<f64> y0;
+  std::vector<f64> x1;
+  std::vector<f64> y1;
+
+  u64 size() const;
+  void reserve(u64 count);
+  void push_back(haversine_pair const &pair);
+};
+
+// Non-owning structure-of-arrays view, e.g. straight into a mapped .hvb file.
+struct haversine_pairs_view {
+  std::span<f64 const> x0;
+  std::span<f64 const> y0;
+  std::span<f64 const> x1;
+  std::span<f64 const> y1;
+
+  u64 size() const;
+};
+
+struct haversine_sum {
+  u64 pairCount;
+  f64 sum;
+};
+
+u64 getPairCount(JsonValue const &data);
+f64 sumHaversineDistances(u64 PairCount, JsonValue const &data);
+haversine_sum streamHaversineDistances(JsonTokenizer tokenizer);
+haversine_pairs readHaversinePairs(JsonTokenizer tokenizer);
+// Splits the pairs array of input into threadCount byte ranges, each resynced
+// to the next '{', and parses them concurrently. The result is identical to
+// readHaversinePairs, so any sum over it is bit-for-bit the serial one. Needs
+// the generator's layout: flat pair objects and nothing after the array but
+// the closing brace. Anything else is parsed serially.
+haversine_pairs readHaversinePairsParallel(std::string_view input,
+                                           u32 threadCount);
+f64 sumHaversineDistances(
+    haversine_pairs const &pairs,
+    haversine_kernel kernel = GetBestHaversineKernel());
+f64 sumHaversineDistances(
+    haversine_pairs_view pairs,
+    haversine_kernel kernel = GetBestHaversineKernel());
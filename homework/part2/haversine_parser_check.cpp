@@ -0,0 +1,125 @@
+#include "haversine_parser.hpp"
+#include "types.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+// Parses the same pairs written compactly and with whitespace in every place
+// JSON allows it, through the DOM, stream and pairs paths, and fails when any
+// spelling reads differently. Run by ctest.
+
+static bool samePairs(haversine_pairs const &a, haversine_pairs const &b) {
+  auto same = [](std::vector<f64> const &x, std::vector<f64> const &y) {
+    return x.size() == y.size() &&
+           std::memcmp(x.data(), y.data(), x.size() * sizeof(f64)) == 0;
+  };
+  return same(a.x0, b.x0) && same(a.y0, b.y0) && same(a.x1, b.x1) &&
+         same(a.y1, b.y1);
+}
+
+// NOTE: Puts space around every structural character, so whitespace lands
+// before and after every token, including inside the first 64-byte block.
+static std::string spaceOut(std::string_view compact, std::string_view space) {
+  std::string result;
+  for (char c : compact) {
+    if (std::strchr("{}[],:", c)) {
+      result.append(space);
+      result.push_back(c);
+      result.append(space);
+    } else {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
+
+static std::string makeCompact(u32 pairCount) {
+  std::string result = "{\"pairs\":[";
+  for (u32 n = 0; n < pairCount; n++) {
+    if (n) {
+      result += ',';
+    }
+    result += "{\"x0\":" + std::to_string(n * 1.5 - 90) +
+              ",\"y0\":" + std::to_string(n * 0.25 - 45) +
+              ",\"x1\":" + std::to_string(n * -1.75 + 120) +
+              ",\"y1\":" + std::to_string(n * 0.5 - 30) + "}";
+  }
+  return result + "]}";
+}
+
+struct parse_results {
+  haversine_pairs pairs;
+  u64 domCount;
+  f64 domSum;
+  haversine_sum streamed;
+};
+
+static parse_results parseAll(std::string_view input) {
+  auto document = JsonParser(JsonTokenizer(input)).parse();
+  u64 domCount = getPairCount(document.root());
+  return parse_results{readHaversinePairs(JsonTokenizer(input)), domCount,
+                       sumHaversineDistances(domCount, document.root()),
+                       streamHaversineDistances(JsonTokenizer(input))};
+}
+
+static bool checkInput(std::string_view name, std::string const &input,
+                       parse_results const &expected) {
+  bool ok = true;
+  auto fail = [&](char const *path) {
+    std::cerr << name << ": " << path << " path differs\n";
+    ok = false;
+  };
+
+  try {
+    auto results = parseAll(input);
+    if (results.domCount != expected.domCount ||
+        results.domSum != expected.domSum) {
+      fail("DOM");
+    }
+    if (results.streamed.pairCount != expected.streamed.pairCount ||
+        results.streamed.sum != expected.streamed.sum) {
+      fail("stream");
+    }
+    if (!samePairs(results.pairs, expected.pairs)) {
+      fail("pairs");
+    }
+    if (!samePairs(readHaversinePairsParallel(input, 4), expected.pairs)) {
+      fail("parallel pairs");
+    }
+  } catch (std::exception const &error) {
+    std::cerr << name << ": " << error.what() << '\n';
+    ok = false;
+  }
+  return ok;
+}
+
+int main() {
+  bool ok = true;
+  for (u32 pairCount : {1u, 3u, 200u}) {
+    std::string compact = makeCompact(pairCount);
+    parse_results expected = parseAll(compact);
+    if (expected.pairs.size() != pairCount) {
+      std::cerr << "compact: read " << expected.pairs.size() << " of "
+                << pairCount << " pairs\n";
+      ok = false;
+      continue;
+    }
+
+    std::string const longRun(70, ' ');
+    ok &= checkInput("leading", " " + compact, expected);
+    ok &= checkInput("leading 70", longRun + compact, expected);
+    ok &= checkInput("trailing", compact + " \n", expected);
+    ok &= checkInput("interior", spaceOut(compact, " "), expected);
+    ok &= checkInput("mixed", "\r\n" + spaceOut(compact, "\t\n \r") + "\n",
+                     expected);
+    ok &= checkInput("long runs", longRun + spaceOut(compact, longRun) +
+                                      longRun,
+                     expected);
+  }
+
+  std::cout << (ok ? "All whitespace spellings parse the same\n"
+                   : "Whitespace spellings differ\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+#include "input_file.hpp"
+
+#include "types.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if _WIN32
+
+#include <windows.h>
+
+// Returns nullptr when the path can't be mapped, so the caller falls back to
+// read_file.
+static char const *MapFile(std::filesystem::path const &path, u64 &size) {
+  HANDLE File = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if (File == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+
+  char const *Data = nullptr;
+  LARGE_INTEGER FileSize;
+  if (GetFileType(File) == FILE_TYPE_DISK && GetFileSizeEx(File, &FileSize) &&
+      FileSize.QuadPart > 0) {
+    HANDLE Mapping = CreateFileMappingW(File, 0, PAGE_READONLY, 0, 0, 0);
+    if (Mapping) {
+      Data = static_cast<char const *>(
+          MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0));
+      // NOTE: The view keeps the mapping alive, so both handles can go.
+      CloseHandle(Mapping);
+    }
+    if (Data) {
+      size = static_cast<u64>(FileSize.QuadPart);
+    }
+  }
+
+  CloseHandle(File);
+  return Data;
+}
+
+static void UnmapFile(char const *data, u64) {
+  UnmapViewOfFile(data);
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Returns nullptr when the path can't be mapped, so the caller falls back to
+// read_file.
+static char const *MapFile(std::filesystem::path const &path, u64 &size) {
+  int File = open(path.c_str(), O_RDONLY);
+  if (File < 0) {
+    return nullptr;
+  }
+
+  char const *Data = nullptr;
+  struct stat Stat;
+  if (fstat(File, &Stat) == 0 && S_ISREG(Stat.st_mode) && Stat.st_size > 0) {
+    void *Mapping = mmap(0, Stat.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+    if (Mapping != MAP_FAILED) {
+      // NOTE: The parser walks the file front to back exactly once.
+      madvise(Mapping, Stat.st_size, MADV_SEQUENTIAL);
+      Data = static_cast<char const *>(Mapping);
+      size = static_cast<u64>(Stat.st_size);
+    }
+  }
+
+  // NOTE: The mapping holds its own reference to the file.
+  close(File);
+  return Data;
+}
+
+static void UnmapFile(char const *data, u64 size) {
+  munmap(const_cast<char *>(data), size);
+}
+
+#endif
+
+InputFile::InputFile(std::filesystem::path const &path)
+    : m_data{nullptr}, m_size{0}, m_mapped{false} {
+  m_data = MapFile(path, m_size);
+  if (m_data) {
+    m_mapped = true;
+    return;
+  }
+
+  if (!std::filesystem::exists(path)) {
+    throw std::runtime_error{"Unable to open " + path.string()};
+  }
+
+  m_buffer = read_file(path);
+  m_data = m_buffer.data();
+  m_size = m_buffer.size();
+}
+
+InputFile::~InputFile() { _unmap(); }
+
+InputFile::InputFile(InputFile &&other) noexcept
+    : m_data{std::exchange(other.m_data, nullptr)},
+      m_size{std::exchange(other.m_size, 0)},
+      m_mapped{std::exchange(other.m_mapped, false)},
+      m_buffer{std::move(other.m_buffer)} {
+  if (!m_mapped) {
+    m_data = m_buffer.data();
+  }
+}
+
+InputFile &InputFile::operator=(InputFile &&other) noexcept {
+  if (this != &other) {
+    _unmap();
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+    m_mapped = std::exchange(other.m_mapped, false);
+    m_buffer = std::move(other.m_buffer);
+    if (!m_mapped) {
+      m_data = m_buffer.data();
+    }
+  }
+  return *this;
+}
+
+std::string_view InputFile::view() const { return {m_data, m_size}; }
+
+bool InputFile::is_mapped() const { return m_mapped; }
+
+void InputFile::_unmap() {
+  if (m_mapped) {
+    UnmapFile(m_data, m_size);
+    m_mapped = false;
+  }
+  m_data = nullptr;
+  m_size = 0;
+}
+
+std::string read_file(std::filesystem::path const &path) {
+  std::ifstream fp(path, std::ios::in | std::ios::binary);
+  std::stringstream buffer;
+  buffer << fp.rdbuf();
+  return buffer.str();
+}
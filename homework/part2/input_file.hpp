@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// Read-only view over the bytes of an input file. Regular files are
+// memory-mapped so the parser can work on the page cache directly; anything
+// that cannot be mapped (pipes, character devices, ...) falls back to reading
+// the whole stream into a buffer with read_file.
+class InputFile {
+public:
+  explicit InputFile(std::filesystem::path const &path);
+  ~InputFile();
+
+  InputFile(InputFile const &) = delete;
+  InputFile &operator=(InputFile const &) = delete;
+  InputFile(InputFile &&other) noexcept;
+  InputFile &operator=(InputFile &&other) noexcept;
+
+  std::string_view view() const;
+  bool is_mapped() const;
+
+private:
+  char const *m_data;
+  u64 m_size;
+  bool m_mapped;
+  std::string m_buffer;
+
+  void _unmap();
+};
+
+std::string read_file(std::filesystem::path const &path);
@@ -1,22 +1,109 @@
+#include "haversine_binary.hpp"
 #include "haversine_parser.hpp"
 #include "types.hpp"
 
+#include <charconv>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <optional>
+#include <string_view>
+#include <thread>
+
+static bool parseKernel(std::string_view name, haversine_kernel &kernel) {
+  for (u32 index = 0; index < static_cast<u32>(haversine_kernel::Count);
+       index++) {
+    auto candidate = static_cast<haversine_kernel>(index);
+    if (name == GetHaversineKernelName(candidate)) {
+      kernel = candidate;
+      return IsHaversineKernelSupported(candidate);
+    }
+  }
+  return false;
+}
+
+// NOTE: 0 means one thread per core.
+static bool parseThreadCount(std::string_view text, u32 &threadCount) {
+  u32 value = 0;
+  auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  if (error != std::errc{} || end != text.data() + text.size()) {
+    return false;
+  }
+  threadCount = value ? value : std::thread::hardware_concurrency();
+  return true;
+}
 
 int main(int argc, char *argv[]) {
-  if (argc == 2 || argc == 3) {
-    auto const file_content = read_file(argv[1]);
-    auto tokenizer = JsonTokenizer(file_content);
-    auto parser = JsonParser(std::move(tokenizer));
-    auto data = parser.parse();
-
-    auto pairCount = getPairCount(data);
-    std::cout << "Input size: " << file_content.size() << '\n';
+  constexpr std::string_view mode_flag = "--mode=";
+  constexpr std::string_view kernel_flag = "--kernel=";
+  constexpr std::string_view threads_flag = "--threads=";
+  char const *program = argv[0];
+  std::string_view mode = "dom";
+  auto kernel = GetBestHaversineKernel();
+  u32 threadCount = 1;
+  bool valid = true;
+  for (; argc > 1 && std::string_view{argv[1]}.starts_with("--");
+       argc--, argv++) {
+    std::string_view option = argv[1];
+    if (option.starts_with(mode_flag)) {
+      mode = option.substr(mode_flag.size());
+      valid &= (mode == "dom" || mode == "stream" || mode == "pairs");
+    } else if (option.starts_with(kernel_flag)) {
+      valid &= parseKernel(option.substr(kernel_flag.size()), kernel);
+    } else if (option.starts_with(threads_flag)) {
+      valid &= parseThreadCount(option.substr(threads_flag.size()),
+                                threadCount);
+    } else {
+      valid = false;
+    }
+  }
+
+  if (valid && (argc == 2 || argc == 3)) {
+    std::filesystem::path const path{argv[1]};
+    u64 inputSize = 0;
+    u64 pairCount = 0;
+    f64 sum = 0;
+    std::optional<f64> refSum;
+    if (path.extension() == ".hvb") {
+      // NOTE: Binary input has nothing to parse; it goes straight to the
+      // kernel and carries its own reference sum.
+      HaversineBinaryFile const binary{path};
+      inputSize = std::filesystem::file_size(path);
+      pairCount = binary.header().pairCount;
+      sum = sumHaversineDistances(binary.pairs(), kernel);
+      refSum = binary.header().expectedSum;
+      std::cout << "Method: " << getHaversineMethodName(binary.header().method)
+                << '\n'
+                << "Random seed: " << binary.header().seed << '\n'
+                << "Kernel: " << GetHaversineKernelName(kernel) << '\n';
+    } else {
+      InputFile const input{path};
+      auto tokenizer = JsonTokenizer(input.view());
+      inputSize = input.view().size();
+
+      if (mode == "stream") {
+        auto result = streamHaversineDistances(std::move(tokenizer));
+        pairCount = result.pairCount;
+        sum = result.sum;
+      } else if (mode == "pairs") {
+        auto pairs = readHaversinePairsParallel(input.view(), threadCount);
+        pairCount = pairs.size();
+        sum = sumHaversineDistances(pairs, kernel);
+        std::cout << "Kernel: " << GetHaversineKernelName(kernel) << '\n';
+      } else {
+        auto parser = JsonParser(std::move(tokenizer));
+        auto document = parser.parse();
+        auto const &data = document.root();
+        pairCount = getPairCount(data);
+        sum = sumHaversineDistances(pairCount, data);
+      }
+    }
+
+    std::cout << "Input size: " << inputSize << '\n';
     std::cout << "Pair count: " << pairCount << '\n';
     constexpr auto max_precision{std::numeric_limits<long double>::digits10};
-    auto sum = sumHaversineDistances(pairCount, data);
     std::cout << std::setprecision(max_precision) << "Haversine sum: " << sum
               << '\n';
 
@@ -31,17 +118,28 @@ int main(int argc, char *argv[]) {
       }
 
       haver.seekg(refCount * sizeof(f64));
-      f64 refSum;
-      haver.read(reinterpret_cast<char *>(&refSum), sizeof(refSum));
+      refSum.emplace();
+      haver.read(reinterpret_cast<char *>(&*refSum), sizeof(f64));
+    }
 
-      std::cout << "Reference sum: " << refSum << '\n';
-      std::cout << "Difference: " << sum - refSum << '\n';
+    if (refSum) {
+      std::cout << "Reference sum: " << *refSum << '\n';
+      std::cout << "Difference: " << sum - *refSum << '\n';
     }
 
   } else {
-    std::cerr << "Usage: " << argv[0] << " [haversine_input.json]\n"
-              << "       " << argv[0]
-              << " [haversine_input.json] [answers.f64]\n";
+    std::cerr
+        << "Usage: " << program << " [options] [haversine_input.json]\n"
+        << "       " << program
+        << " [options] [haversine_input.json] [answers.f64]\n"
+        << "       " << program << " [options] [haversine_input.hvb]\n"
+        << "Options:\n"
+        << "  --mode=dom|stream|pairs        parse into a JSON tree (default),"
+           " a running sum or structure-of-arrays pairs\n"
+        << "  --kernel=reference|avx2|avx512 haversine kernel for "
+           "--mode=pairs and .hvb input (default: widest supported)\n"
+        << "  --threads=N                    parse --mode=pairs input on N "
+           "threads, 0 for one per core (default: 1)\n";
     return 1;
   }
 
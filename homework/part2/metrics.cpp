@@ -2,62 +2,284 @@
 
 #include "types.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
 #if _WIN32
 
 #include <intrin.h>
 #include <windows.h>
 
-static u64 GetOSTimerFreq(void) {
+u64 GetOSTimerFreq(void) {
   LARGE_INTEGER Freq;
   QueryPerformanceFrequency(&Freq);
   return Freq.QuadPart;
 }
 
-static u64 ReadOSTimer(void) {
+u64 ReadOSTimer(void) {
   LARGE_INTEGER Value;
   QueryPerformanceCounter(&Value);
   return Value.QuadPart;
 }
 
+static void ReadCPUID(u32 Leaf, std::array<u32, 4> &Registers) {
+  int Values[4];
+  __cpuidex(Values, static_cast<int>(Leaf), 0);
+  for (u32 Index = 0; Index < 4; Index++) {
+    Registers[Index] = static_cast<u32>(Values[Index]);
+  }
+}
+
 #else
 
-#include <sys/time.h>
+#include <cpuid.h>
+#include <time.h>
 #include <x86intrin.h>
 
-static u64 GetOSTimerFreq(void) { return 1000000; }
+#if __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+u64 GetOSTimerFreq(void) { return 1000000000; }
 
-static u64 ReadOSTimer(void) {
-  // NOTE(casey): The "struct" keyword is not necessary here when compiling in
-  // C++, but just in case anyone is using this file from C, I include it.
-  struct timeval Value;
-  gettimeofday(&Value, 0);
+u64 ReadOSTimer(void) {
+  // NOTE: MONOTONIC_RAW isn't slewed by NTP, so a short calibration window
+  // can't be stretched or squeezed by a clock adjustment, and it's read
+  // through the vDSO without a syscall.
+  struct timespec Value;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &Value);
 
-  u64 Result = GetOSTimerFreq() * (u64)Value.tv_sec + (u64)Value.tv_usec;
+  u64 Result = GetOSTimerFreq() * (u64)Value.tv_sec + (u64)Value.tv_nsec;
   return Result;
 }
 
+static void ReadCPUID(u32 Leaf, std::array<u32, 4> &Registers) {
+  __cpuid_count(Leaf, 0, Registers[0], Registers[1], Registers[2],
+                Registers[3]);
+}
+
 #endif
 
-u64 GetCPUFreq() {
-  u64 MillisecondsToWait = 100;
+std::string GetCPUBrand() {
+  std::string Brand;
+  std::array<u32, 4> Registers;
+  ReadCPUID(0x80000000, Registers);
+  if (Registers[0] >= 0x80000004) {
+    for (u32 Leaf = 0x80000002; Leaf <= 0x80000004; Leaf++) {
+      ReadCPUID(Leaf, Registers);
+      Brand.append(reinterpret_cast<char const *>(Registers.data()),
+                   sizeof(Registers));
+    }
+    Brand.resize(std::strlen(Brand.c_str()));
+  }
+
+  // NOTE: Some vendors pad the brand string with leading spaces.
+  auto First = Brand.find_first_not_of(' ');
+  auto Last = Brand.find_last_not_of(' ');
+  if (First == std::string::npos) {
+    return {};
+  }
+  return Brand.substr(First, Last - First + 1);
+}
+
+static char const *GlobalCPUFreqSource = "unknown";
+
+// NOTE: Leaf 0x15 gives the TSC as a ratio of the core crystal clock. Some
+// parts leave the crystal frequency 0; then the TSC runs at the base
+// frequency from leaf 0x16, as the kernel assumes too.
+static u64 ReadCPUIDFreq() {
+  std::array<u32, 4> Registers;
+  ReadCPUID(0x80000000, Registers);
+  if (Registers[0] < 0x80000007) {
+    return 0;
+  }
+
+  // NOTE: Without an invariant TSC the tick rate follows the core clock, so
+  // there is no single frequency to report.
+  ReadCPUID(0x80000007, Registers);
+  if (!(Registers[3] & (1 << 8))) {
+    return 0;
+  }
+
+  ReadCPUID(0, Registers);
+  u32 MaxLeaf = Registers[0];
+  if (MaxLeaf < 0x15) {
+    return 0;
+  }
+
+  ReadCPUID(0x15, Registers);
+  u64 Denominator = Registers[0];
+  u64 Numerator = Registers[1];
+  u64 CrystalFreq = Registers[2];
+  if (!Denominator || !Numerator) {
+    return 0;
+  }
+  if (CrystalFreq) {
+    return CrystalFreq * Numerator / Denominator;
+  }
+
+  if (MaxLeaf >= 0x16) {
+    ReadCPUID(0x16, Registers);
+    return (u64)Registers[0] * 1000000;
+  }
+  return 0;
+}
+
+// NOTE: When the kernel lets user space convert TSC ticks to nanoseconds
+// itself (cap_user_time), the conversion in the perf mmap page is the
+// kernel's own calibrated TSC frequency.
+static u64 ReadPerfPageFreq() {
+  u64 Result = 0;
+#if __linux__
+  perf_event_attr Attr{};
+  Attr.size = sizeof(Attr);
+  Attr.type = PERF_TYPE_SOFTWARE;
+  Attr.config = PERF_COUNT_SW_DUMMY;
+  Attr.exclude_kernel = 1;
+  Attr.exclude_hv = 1;
+
+  int File = static_cast<int>(
+      syscall(SYS_perf_event_open, &Attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+  if (File < 0) {
+    return 0;
+  }
+
+  auto PageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  void *Page = mmap(nullptr, PageSize, PROT_READ, MAP_SHARED, File, 0);
+  if (Page != MAP_FAILED) {
+    auto *Info = static_cast<perf_event_mmap_page *>(Page);
+    if (Info->cap_user_time && Info->time_mult) {
+      Result = static_cast<u64>(
+          ((unsigned __int128)1000000000 << Info->time_shift) /
+          Info->time_mult);
+    }
+    munmap(Page, PageSize);
+  }
+  close(File);
+#endif
+  return Result;
+}
+
+// NOTE: The median of a few short windows rather than one long one: an
+// interrupt landing in a window only spoils that sample, and the whole
+// thing takes about 10ms instead of the old 100ms.
+static u64 CalibrateCPUFreq() {
+  constexpr u32 SampleCount = 5;
+  constexpr u64 MicrosecondsPerSample = 2000;
+
   u64 OSFreq = GetOSTimerFreq();
+  u64 OSWaitTime = OSFreq * MicrosecondsPerSample / 1000000;
+  std::array<u64, SampleCount> Samples;
+  for (auto &Sample : Samples) {
+    u64 CPUStart = ReadCPUTimer();
+    u64 OSStart = ReadOSTimer();
+    u64 OSElapsed = 0;
+    while (OSElapsed < OSWaitTime) {
+      OSElapsed = ReadOSTimer() - OSStart;
+    }
+    u64 CPUElapsed = ReadCPUTimer() - CPUStart;
+    Sample = OSElapsed ? OSFreq * CPUElapsed / OSElapsed : 0;
+  }
+
+  std::sort(Samples.begin(), Samples.end());
+  return Samples[SampleCount / 2];
+}
 
-  u64 CPUStart = ReadCPUTimer();
-  u64 OSStart = ReadOSTimer();
-  u64 OSEnd = 0;
-  u64 OSElapsed = 0;
-  u64 OSWaitTime = OSFreq * MillisecondsToWait / 1000;
-  while (OSElapsed < OSWaitTime) {
-    OSEnd = ReadOSTimer();
-    OSElapsed = OSEnd - OSStart;
+static std::filesystem::path GetCPUFreqCachePath() {
+#if _WIN32
+  char const *Directory = std::getenv("LOCALAPPDATA");
+  if (!Directory) {
+    return {};
   }
+  return std::filesystem::path{Directory} / "homework_cpu_freq";
+#else
+  if (char const *Directory = std::getenv("XDG_CACHE_HOME")) {
+    return std::filesystem::path{Directory} / "homework_cpu_freq";
+  }
+  if (char const *Home = std::getenv("HOME")) {
+    return std::filesystem::path{Home} / ".cache" / "homework_cpu_freq";
+  }
+  return {};
+#endif
+}
 
-  u64 CPUEnd = ReadCPUTimer();
-  u64 CPUElapsed = CPUEnd - CPUStart;
-  u64 CPUFreq = 0;
-  if (OSElapsed) {
-    CPUFreq = OSFreq * CPUElapsed / OSElapsed;
+// NOTE: A cached calibration is only trusted on the same CPU model, and on
+// Linux only until the next boot, since a VM can come back up on a
+// different host.
+static std::string GetCPUFreqCacheKey() {
+  std::string Key = GetCPUBrand();
+#if __linux__
+  std::ifstream BootId{"/proc/sys/kernel/random/boot_id"};
+  std::string Boot;
+  if (std::getline(BootId, Boot)) {
+    Key += " boot " + Boot;
   }
+#endif
+  return Key;
+}
 
+static u64 ReadCachedCPUFreq(std::filesystem::path const &Path,
+                             std::string const &Key) {
+  std::ifstream File{Path};
+  std::string CachedKey;
+  u64 Freq = 0;
+  if (std::getline(File, CachedKey) && CachedKey == Key && File >> Freq) {
+    return Freq;
+  }
+  return 0;
+}
+
+// NOTE: Best effort; a read-only or missing cache directory just means the
+// next run calibrates again.
+static void WriteCachedCPUFreq(std::filesystem::path const &Path,
+                               std::string const &Key, u64 Freq) {
+  std::error_code Error;
+  std::filesystem::create_directories(Path.parent_path(), Error);
+  std::ofstream File{Path, std::ios_base::trunc};
+  File << Key << '\n' << Freq << '\n';
+}
+
+static u64 DetectCPUFreq() {
+  if (u64 Freq = ReadCPUIDFreq()) {
+    GlobalCPUFreqSource = "cpuid";
+    return Freq;
+  }
+  if (u64 Freq = ReadPerfPageFreq()) {
+    GlobalCPUFreqSource = "perf";
+    return Freq;
+  }
+
+  auto Path = GetCPUFreqCachePath();
+  auto Key = GetCPUFreqCacheKey();
+  if (!Path.empty()) {
+    if (u64 Freq = ReadCachedCPUFreq(Path, Key)) {
+      GlobalCPUFreqSource = "cached calibration";
+      return Freq;
+    }
+  }
+
+  u64 Freq = CalibrateCPUFreq();
+  GlobalCPUFreqSource = "calibration";
+  if (!Path.empty() && Freq) {
+    WriteCachedCPUFreq(Path, Key, Freq);
+  }
+  return Freq;
+}
+
+u64 GetCPUFreq() {
+  static u64 const CPUFreq = DetectCPUFreq();
   return CPUFreq;
 }
+
+char const *GetCPUFreqSource() {
+  GetCPUFreq();
+  return GlobalCPUFreqSource;
+}
@@ -1,12 +1,15 @@
+#pragma once
+
 #include "types.hpp"
 
+#include <string>
+
 #if _WIN32
 
 #include <intrin.h>
 
 #else
 
-#include <sys/time.h>
 #include <x86intrin.h>
 
 #endif
@@ -26,4 +29,12 @@ inline u64 ReadCPUTimer(void) {
   return __rdtsc();
 }
 
+// TSC ticks per second. Taken from CPUID leaf 0x15/0x16 or the kernel's
+// perf mmap page when either knows it; otherwise measured against the OS
+// timer once and cached on disk. Detected on the first call only.
 u64 GetCPUFreq();
+// Where GetCPUFreq got its answer, for reports ("cpuid", "perf",
+// "calibration" or "cached calibration").
+char const *GetCPUFreqSource();
+// CPU model from the CPUID brand string, or empty when the CPU has none.
+std::string GetCPUBrand();
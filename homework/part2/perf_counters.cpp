@@ -0,0 +1,131 @@
+#include "perf_counters.hpp"
+
+#include "types.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#if PERF_COUNTERS_SUPPORTED
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct perf_counter_event {
+  u32 type;
+  u64 config;
+};
+
+static constexpr u64 CacheEvent(u64 cache, u64 op, u64 result) {
+  return cache | (op << 8) | (result << 16);
+}
+
+// NOTE: Same order as perf_counter.
+static constexpr perf_counter_event PerfCounterEvents[PerfCounterCount] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HW_CACHE,
+     CacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+PerfCounters::PerfCounters() {
+  m_fds.fill(-1);
+  m_pages.fill(nullptr);
+
+  // NOTE: Every event is opened on its own rather than as a group: a PMU
+  // that lacks one of them (common in VMs) then only loses that counter,
+  // and there are few enough that the kernel doesn't need to multiplex.
+  for (u32 index = 0; index < PerfCounterCount; index++) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PerfCounterEvents[index].type;
+    attr.config = PerfCounterEvents[index].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    if (fd < 0) {
+      if (m_error.empty()) {
+        m_error = std::string{"perf_event_open("} +
+                  getPerfCounterName(static_cast<perf_counter>(index)) +
+                  "): " + std::strerror(errno);
+      }
+      continue;
+    }
+    m_fds[index] = fd;
+
+    // NOTE: Without the page, reads fall back to the syscall; keep going.
+    void *page = mmap(nullptr, static_cast<size_t>(sysconf(_SC_PAGESIZE)),
+                      PROT_READ, MAP_SHARED, fd, 0);
+    if (page != MAP_FAILED) {
+      m_pages[index] = static_cast<perf_event_mmap_page *>(page);
+    }
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  for (u32 index = 0; index < PerfCounterCount; index++) {
+    if (m_pages[index]) {
+      munmap(const_cast<perf_event_mmap_page *>(m_pages[index]), pageSize);
+    }
+    if (m_fds[index] >= 0) {
+      close(m_fds[index]);
+    }
+  }
+}
+
+bool PerfCounters::available(perf_counter counter) const {
+  return m_fds[static_cast<u32>(counter)] >= 0;
+}
+
+u64 PerfCounters::_readSlow(u32 index) const {
+  u64 count = 0;
+  if (::read(m_fds[index], &count, sizeof(count)) != sizeof(count)) {
+    return 0;
+  }
+  return count;
+}
+
+#else
+
+PerfCounters::PerfCounters()
+    : m_error{"Hardware counters are only supported on x86 Linux"} {}
+
+PerfCounters::~PerfCounters() = default;
+
+bool PerfCounters::available(perf_counter) const { return false; }
+
+#endif
+
+bool PerfCounters::anyAvailable() const {
+  for (u32 index = 0; index < PerfCounterCount; index++) {
+    if (available(static_cast<perf_counter>(index))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string const &PerfCounters::error() const { return m_error; }
+
+char const *getPerfCounterName(perf_counter counter) {
+  switch (counter) {
+  case perf_counter::Instructions:
+    return "instructions";
+  case perf_counter::Cycles:
+    return "cycles";
+  case perf_counter::L1DMisses:
+    return "L1D read misses";
+  case perf_counter::LLCMisses:
+    return "LLC misses";
+  case perf_counter::BranchMisses:
+    return "branch misses";
+  }
+  return "unknown";
+}
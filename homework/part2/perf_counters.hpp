@@ -0,0 +1,117 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#if __linux__ && (__x86_64__ || __i386__)
+#define PERF_COUNTERS_SUPPORTED 1
+#include <linux/perf_event.h>
+#include <x86intrin.h>
+#else
+#define PERF_COUNTERS_SUPPORTED 0
+#endif
+
+enum class perf_counter : u32 {
+  Instructions,
+  Cycles,
+  L1DMisses,
+  LLCMisses,
+  BranchMisses,
+};
+
+inline constexpr u32 PerfCounterCount = 5;
+
+using perf_counter_values = std::array<u64, PerfCounterCount>;
+
+inline u64 getPerfCounter(perf_counter_values const &values,
+                          perf_counter counter) {
+  return values[static_cast<u32>(counter)];
+}
+
+char const *getPerfCounterName(perf_counter counter);
+
+// Hardware counters of the calling thread, read from user space. On Linux
+// each counter is a perf_event_open event whose mmap page lets read() use
+// rdpmc instead of a syscall; everywhere else, or when the kernel refuses
+// (no PMU in a VM, perf_event_paranoid too high), counters are just missing
+// and read as 0. Only counts user-mode work.
+class PerfCounters {
+public:
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(PerfCounters const &) = delete;
+  PerfCounters &operator=(PerfCounters const &) = delete;
+
+  bool available(perf_counter counter) const;
+  bool anyAvailable() const;
+  // Why the first unavailable counter couldn't be opened; empty if all were.
+  std::string const &error() const;
+
+  // NOTE: Only meaningful on the thread that constructed the object, and
+  // only as a difference between two reads.
+  perf_counter_values read() const;
+
+private:
+#if PERF_COUNTERS_SUPPORTED
+  std::array<int, PerfCounterCount> m_fds;
+  std::array<perf_event_mmap_page volatile *, PerfCounterCount> m_pages;
+
+  u64 _read(u32 index) const;
+  u64 _readSlow(u32 index) const;
+#endif
+  std::string m_error;
+};
+
+#if PERF_COUNTERS_SUPPORTED
+
+// NOTE: Sequence-locked read described in linux/perf_event.h. The kernel
+// bumps lock whenever it reschedules the event, so retry if it moved.
+inline u64 PerfCounters::_read(u32 index) const {
+  perf_event_mmap_page volatile *page = m_pages[index];
+  if (!page) {
+    return m_fds[index] >= 0 ? _readSlow(index) : 0;
+  }
+
+  u32 seq;
+  u64 count;
+  u32 rdpmcIndex;
+  do {
+    seq = page->lock;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    rdpmcIndex = page->index;
+    count = page->offset;
+    if (page->cap_user_rdpmc && rdpmcIndex) {
+      // NOTE: The hardware counter is only pmc_width bits wide, so sign
+      // extend it before adding it to the kernel's offset.
+      u32 shift = 64 - page->pmc_width;
+      int64_t pmc = static_cast<int64_t>(__rdpmc(rdpmcIndex - 1));
+      count += static_cast<u64>((pmc << shift) >> shift);
+    }
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  } while (page->lock != seq);
+
+  // NOTE: Index 0 means the event isn't on a hardware counter right now (or
+  // rdpmc is disabled), so only the kernel knows the value.
+  if (!page->cap_user_rdpmc || !rdpmcIndex) {
+    return _readSlow(index);
+  }
+  return count;
+}
+
+inline perf_counter_values PerfCounters::read() const {
+  perf_counter_values values;
+  for (u32 index = 0; index < PerfCounterCount; index++) {
+    values[index] = _read(index);
+  }
+  return values;
+}
+
+#else
+
+inline perf_counter_values PerfCounters::read() const { return {}; }
+
+#endif
@@ -0,0 +1,199 @@
+#include "profile_report.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compares two reports written by WriteProfileReport and flags anchors whose
+// time per hit got slower than a threshold. Exits with 2 when any did, so a
+// script can use it as a regression gate.
+
+struct report_row {
+  std::string label;
+  u64 hitCount;
+  u64 tscElapsedInclusive;
+  u64 p50;
+  u64 p99;
+};
+
+struct report {
+  u64 timerFreq;
+  std::vector<report_row> rows;
+};
+
+static u64 parseU64(std::string_view text) {
+  u64 value = 0;
+  auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  if (error != std::errc{} || end != text.data() + text.size()) {
+    throw std::runtime_error{"Invalid report number: " + std::string{text}};
+  }
+  return value;
+}
+
+// NOTE: Only the label can be quoted; the rest are plain numbers.
+static std::vector<std::string> splitRow(std::string_view line) {
+  std::vector<std::string> fields;
+  std::string label;
+  u64 at = 0;
+  if (!line.empty() && line[0] == '"') {
+    for (at = 1; at < line.size(); at++) {
+      if (line[at] == '"') {
+        if (at + 1 < line.size() && line[at + 1] == '"') {
+          label += '"';
+          at++;
+        } else {
+          at++;
+          break;
+        }
+      } else {
+        label += line[at];
+      }
+    }
+  } else {
+    at = std::min(line.find(','), line.size());
+    label = line.substr(0, at);
+  }
+  fields.push_back(std::move(label));
+
+  while (at < line.size() && line[at] == ',') {
+    u64 next = std::min(line.find(',', at + 1), line.size());
+    fields.emplace_back(line.substr(at + 1, next - at - 1));
+    at = next;
+  }
+  return fields;
+}
+
+static report readReport(char const *path) {
+  std::ifstream file{path};
+  if (!file) {
+    throw std::runtime_error{std::string{"Unable to open "} + path};
+  }
+
+  constexpr std::string_view freq_key = "# timer_freq=";
+  report result{};
+  bool header = false;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.starts_with(freq_key)) {
+      result.timerFreq = parseU64(std::string_view{line}.substr(
+          freq_key.size()));
+    } else if (line.starts_with('#') || line.empty()) {
+      continue;
+    } else if (!header) {
+      if (line != ProfileReportColumns && line != ProfileReportColumnsV1) {
+        throw std::runtime_error{std::string{path} +
+                                 " is not a profile report"};
+      }
+      header = true;
+    } else {
+      auto fields = splitRow(line);
+      if (fields.size() < 9) {
+        throw std::runtime_error{"Malformed report row: " + line};
+      }
+      result.rows.push_back(report_row{fields[0], parseU64(fields[1]),
+                                       parseU64(fields[3]),
+                                       parseU64(fields[5]),
+                                       parseU64(fields[7])});
+    }
+  }
+
+  if (!header) {
+    throw std::runtime_error{std::string{path} + " is not a profile report"};
+  }
+  if (!result.timerFreq) {
+    throw std::runtime_error{std::string{path} + " has no timer frequency"};
+  }
+  return result;
+}
+
+static report_row const *findRow(report const &data, std::string_view label) {
+  for (auto const &row : data.rows) {
+    if (row.label == label) {
+      return &row;
+    }
+  }
+  return nullptr;
+}
+
+// NOTE: Prints one metric in microseconds and returns whether it regressed.
+static bool compareMetric(char const *name, f64 baseCycles, u64 baseFreq,
+                          f64 newCycles, u64 newFreq, f64 threshold) {
+  if (baseCycles == 0 || newCycles == 0) {
+    return false;
+  }
+  f64 baseMicroseconds = 1e6 * baseCycles / (f64)baseFreq;
+  f64 newMicroseconds = 1e6 * newCycles / (f64)newFreq;
+  f64 change = 100.0 * (newMicroseconds / baseMicroseconds - 1.0);
+  bool regressed = change > threshold;
+  std::printf("  %-4s %12.3fus -> %12.3fus  %+8.2f%%%s\n", name,
+              baseMicroseconds, newMicroseconds, change,
+              regressed ? "  REGRESSION" : "");
+  return regressed;
+}
+
+int main(int argc, char *argv[]) {
+  constexpr std::string_view threshold_flag = "--threshold=";
+  char const *program = argv[0];
+  f64 threshold = 5.0;
+  bool valid = true;
+  for (; argc > 1 && std::string_view{argv[1]}.starts_with("--");
+       argc--, argv++) {
+    std::string_view option = argv[1];
+    if (option.starts_with(threshold_flag)) {
+      threshold = std::stod(argv[1] + threshold_flag.size());
+    } else {
+      valid = false;
+    }
+  }
+
+  if (!valid || argc != 3) {
+    std::cerr << "Usage: " << program
+              << " [options] [base_report.csv] [new_report.csv]\n"
+              << "Options:\n"
+              << "  --threshold=PERCENT  flag anchors whose mean, p50 or p99 "
+                 "per hit grew by more than PERCENT (default 5)\n"
+              << "Exits with 2 when any anchor regressed.\n";
+    return 1;
+  }
+
+  auto base = readReport(argv[1]);
+  auto next = readReport(argv[2]);
+
+  u32 regressionCount = 0;
+  for (auto const &row : next.rows) {
+    std::printf("%s[%llu]\n", row.label.c_str(),
+                (unsigned long long)row.hitCount);
+    auto const *old = findRow(base, row.label);
+    if (!old) {
+      std::printf("  new anchor\n");
+      continue;
+    }
+
+    bool regressed = compareMetric(
+        "mean", (f64)old->tscElapsedInclusive / (f64)old->hitCount,
+        base.timerFreq, (f64)row.tscElapsedInclusive / (f64)row.hitCount,
+        next.timerFreq, threshold);
+    regressed |= compareMetric("p50", (f64)old->p50, base.timerFreq,
+                               (f64)row.p50, next.timerFreq, threshold);
+    regressed |= compareMetric("p99", (f64)old->p99, base.timerFreq,
+                               (f64)row.p99, next.timerFreq, threshold);
+    regressionCount += regressed;
+  }
+  for (auto const &row : base.rows) {
+    if (!findRow(next, row.label)) {
+      std::printf("%s\n  removed anchor\n", row.label.c_str());
+    }
+  }
+
+  std::printf("\n%u of %zu anchors regressed by more than %.2f%%\n",
+              regressionCount, next.rows.size(), threshold);
+  return regressionCount ? 2 : 0;
+}
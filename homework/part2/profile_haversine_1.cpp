@@ -31,7 +31,8 @@ int main(int argc, char *argv[]) {
     auto tokenizer = JsonTokenizer(file_content);
     Prof_Parse = ReadCPUTimer();
     auto parser = JsonParser(std::move(tokenizer));
-    auto data = parser.parse();
+    auto document = parser.parse();
+    auto const &data = document.root();
 
     Prof_GetPairs = ReadCPUTimer();
     auto pairCount = getPairCount(data);
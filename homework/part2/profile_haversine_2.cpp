@@ -3,28 +3,98 @@
 #include "types.hpp"
 
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+static InputFile readInput(char const *path) {
+  TimeFunction;
+  InputFile input{path};
+
+  // NOTE: The size is only known once the input is open: a pipe has none
+  // until it has been read to the end. A mapped file is not read until it is
+  // touched, and one byte per page would only fault the pages in (16 at a
+  // time with fault-around), so the block touches every cache line to give
+  // the bandwidth of reading it.
+  auto bytes = input.view();
+  TimeBandwidth("touchInput", bytes.size());
+  u64 touched = 0;
+  for (u64 at = 0; at < bytes.size(); at += 64) {
+    touched += static_cast<unsigned char>(bytes[at]);
+  }
+  u64 volatile sink = touched;
+  (void)sink;
+  return input;
+}
+
+static JsonDocument parseInput(std::string_view input) {
+  TimeBandwidth(__func__, input.size());
+  auto parser = JsonParser(JsonTokenizer(input));
+  return parser.parse();
+}
 
 int main(int argc, char *argv[]) {
   BeginProfile();
 
-  if (argc == 2 || argc == 3) {
-    // Prof_Read = ReadCPUTimer();
-    auto const file_content = read_file(argv[1]);
-    // Prof_MiscSetup = ReadCPUTimer();
-    auto tokenizer = JsonTokenizer(file_content);
-    // Prof_Parse = ReadCPUTimer();
-    auto parser = JsonParser(std::move(tokenizer));
-    auto data = parser.parse();
-
-    // Prof_GetPairs = ReadCPUTimer();
-    auto pairCount = getPairCount(data);
-    std::cout << "Input size: " << file_content.size() << '\n';
+  constexpr std::string_view trace_flag = "--trace=";
+  constexpr std::string_view report_flag = "--report=";
+  constexpr std::string_view format_flag = "--report-format=";
+  constexpr std::string_view samples_flag = "--samples=";
+  constexpr std::string_view sample_flag = "--sample=";
+  char const *program = argv[0];
+  char const *tracePath = nullptr;
+  char const *reportPath = nullptr;
+  auto reportFormat = profile_report_format::Csv;
+  bool valid = true;
+  for (; argc > 1 && std::string_view{argv[1]}.starts_with("--");
+       argc--, argv++) {
+    std::string_view option = argv[1];
+    if (option.starts_with(trace_flag)) {
+      tracePath = argv[1] + trace_flag.size();
+    } else if (option.starts_with(report_flag)) {
+      reportPath = argv[1] + report_flag.size();
+    } else if (option == std::string{format_flag} + "csv") {
+      reportFormat = profile_report_format::Csv;
+    } else if (option == std::string{format_flag} + "json") {
+      reportFormat = profile_report_format::Json;
+    } else if (option.starts_with(samples_flag)) {
+      SetProfileSampleCapacity(std::stoull(argv[1] + samples_flag.size()));
+    } else if (option.starts_with(sample_flag)) {
+      StartProfileSampling(static_cast<u32>(
+          std::stoul(argv[1] + sample_flag.size())));
+    } else {
+      valid = false;
+    }
+  }
+
+  if (valid && (argc == 2 || argc == 3)) {
+    InputFile const input = readInput(argv[1]);
+    SetProfileMetadata("input", argv[1]);
+    SetProfileMetadata("input_bytes", input.view().size());
+    auto document = parseInput(input.view());
+    auto const &data = document.root();
+
+    u64 pairCount = 0;
+    {
+      TimeBlock("getPairCount");
+      pairCount = getPairCount(data);
+    }
+    SetProfileMetadata("pairs", pairCount);
+    f64 sum = 0;
+    {
+      // NOTE: This walks the DOM, not pairCount packed pairs, so there is no
+      // byte count that would make a bandwidth meaningful.
+      TimeBlock("sumHaversineDistances");
+      sum = sumHaversineDistances(pairCount, data);
+    }
+
+    TimeBlock("MiscOutput");
+    std::cout << "Input size: " << input.view().size() << '\n';
     std::cout << "Pair count: " << pairCount << '\n';
     constexpr auto max_precision{std::numeric_limits<long double>::digits10};
-    // Prof_Sum = ReadCPUTimer();
-    auto sum = sumHaversineDistances(pairCount, data);
-    // Prof_MiscOutput = ReadCPUTimer();
     std::cout << std::setprecision(max_precision) << "Haversine sum: " << sum
               << '\n';
 
@@ -47,12 +117,30 @@ int main(int argc, char *argv[]) {
     }
 
   } else {
-    std::cerr << "Usage: " << argv[0] << " [haversine_input.json]\n"
-              << "       " << argv[0]
-              << " [haversine_input.json] [answers.f64]\n";
+    std::cerr << "Usage: " << program << " [options] [haversine_input.json]\n"
+              << "       " << program
+              << " [options] [haversine_input.json] [answers.f64]\n"
+              << "Options:\n"
+              << "  --trace=FILE  write the block trace to FILE for "
+                 "profile_trace_to_json (needs HOMEWORK_PROFILER_TRACE)\n"
+              << "  --report=FILE  write the anchors and run metadata to "
+                 "FILE (CSV reads with profile_compare)\n"
+              << "  --report-format=csv|json  format of --report (default "
+                 "csv)\n"
+              << "  --samples=N    keep N per-hit durations per thread for "
+                 "exact percentiles (needs HOMEWORK_PROFILER_HISTOGRAMS)\n"
+              << "  --sample=HZ    sample the program HZ times per CPU second "
+                 "and print where the time went\n";
     return 1;
   }
 
   EndAndPrintProfile();
+  if (reportPath) {
+    WriteProfileReport(reportPath, reportFormat);
+  }
+  if (tracePath) {
+    WriteProfileTrace(tracePath);
+  }
   return 0;
 }
+
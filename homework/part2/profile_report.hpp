@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.hpp"
+
+// CSV report written by WriteProfileReport and read by profile_compare:
+//
+//   # profile report <ProfileReportVersion>
+//   # timer_freq=<TSC ticks per second>
+//   # <key>=<value> for the rest of the run metadata
+//   <ProfileReportColumns>
+//   one row per anchor that was hit, merged across threads
+//
+// Labels are quoted, with embedded quotes doubled. Durations are in TSC
+// cycles; p50..max are per hit and 0 when the build had no
+// PROFILER_HISTOGRAMS. bytes_per_second is bytes over inclusive time, 0 for
+// anchors without a byte count. Readers skip any other "#" lines.
+//
+// The JSON report holds the same data as one object:
+//
+//   {"version": <ProfileReportVersion>,
+//    "metadata": {"timer_freq": ..., "cpu": ..., <key>: <value>, ...},
+//    "anchors": [{"label": ..., <one member per column>}, ...]}
+inline constexpr u32 ProfileReportVersion = 2;
+
+inline constexpr char const *ProfileReportColumns =
+    "label,hits,exclusive_cycles,inclusive_cycles,bytes,"
+    "p50_cycles,p90_cycles,p99_cycles,max_cycles,bytes_per_second";
+
+// NOTE: Version 1 had no bytes_per_second; profile_compare still reads it.
+inline constexpr char const *ProfileReportColumnsV1 =
+    "label,hits,exclusive_cycles,inclusive_cycles,bytes,"
+    "p50_cycles,p90_cycles,p99_cycles,max_cycles";
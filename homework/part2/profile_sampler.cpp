@@ -0,0 +1,358 @@
+#include "profile_sampler.hpp"
+
+#include "profiler.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if __linux__ && __x86_64__
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <fstream>
+#include <iterator>
+#include <link.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+// NOTE: One buffer for the whole process. Handlers on any thread claim a
+// slot with a single fetch_add, so nothing in the signal path can block and
+// threads the profiler never saw still get sampled.
+static std::unique_ptr<profile_sample_event[]> GlobalSamples;
+static u64 GlobalSampleCapacity;
+static std::atomic<u64> GlobalSampleCount;
+static u32 GlobalSampleFrequency;
+
+static void SampleProfile(int, siginfo_t *, void *context) {
+  u64 index = GlobalSampleCount.fetch_add(1, std::memory_order_relaxed);
+  if (index >= GlobalSampleCapacity) {
+    return;
+  }
+
+  auto &sample = GlobalSamples[index];
+  sample.depth = 0;
+#if PROFILER
+  if (profile_thread *thread = GlobalProfilerThread) {
+#if PROFILER_SAMPLING
+    u32 depth = std::min(thread->depth, ProfileSampleStackDepth);
+    for (u32 n = 0; n < depth; n++) {
+      sample.stack[n] = thread->stack[n];
+    }
+    sample.depth = depth;
+#else
+    // NOTE: Without the stack only the innermost open block is known.
+    if (thread->parent) {
+      sample.stack[0] = thread->parent;
+      sample.depth = 1;
+    }
+#endif
+  }
+#endif
+
+  // NOTE: rip goes in last, so the report can tell finished samples from
+  // ones a handler was still writing when sampling stopped.
+  auto *ucontext = static_cast<ucontext_t *>(context);
+  u64 rip = static_cast<u64>(ucontext->uc_mcontext.gregs[REG_RIP]);
+  std::atomic_ref<u64>{sample.rip}.store(rip ? rip : 1,
+                                         std::memory_order_release);
+}
+
+void StartProfileSampling(u32 frequency, u64 capacity) {
+  if (!frequency || !capacity) {
+    throw std::runtime_error{"Sampling needs a frequency and a capacity"};
+  }
+  if (GlobalSamples) {
+    throw std::runtime_error{"Profile sampling already started"};
+  }
+  GlobalSamples = std::make_unique<profile_sample_event[]>(capacity);
+  GlobalSampleCapacity = capacity;
+  GlobalSampleCount = 0;
+  GlobalSampleFrequency = frequency;
+
+  // NOTE: SA_RESTART, so the program's own reads and waits don't start
+  // failing with EINTR.
+  struct sigaction action {};
+  action.sa_sigaction = SampleProfile;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, nullptr) != 0) {
+    throw std::runtime_error{"Unable to install the SIGPROF handler"};
+  }
+
+  // NOTE: ITIMER_PROF counts CPU time of the whole process and signals the
+  // thread that was running. The kernel only checks it on scheduler ticks,
+  // so frequencies above CONFIG_HZ are capped.
+  u64 interval = std::max<u64>(1, 1000000 / frequency);
+  itimerval timer{};
+  timer.it_interval.tv_sec = static_cast<time_t>(interval / 1000000);
+  timer.it_interval.tv_usec = static_cast<suseconds_t>(interval % 1000000);
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    throw std::runtime_error{"Unable to start the sampling timer"};
+  }
+}
+
+void StopProfileSampling() {
+  if (!GlobalSamples) {
+    return;
+  }
+  itimerval timer{};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  // NOTE: Ignore rather than restore the default, which would kill the
+  // process if a last SIGPROF is still pending.
+  signal(SIGPROF, SIG_IGN);
+}
+
+struct profile_symbol {
+  u64 start;
+  u64 end;
+  char const *name;
+};
+
+// NOTE: Reads the executable's own .symtab, so static and inlined-into
+// functions resolve too, which dladdr alone can't do. Symbols outside the
+// executable (libc, libm) still go through dladdr.
+class ProfileSymbols {
+public:
+  ProfileSymbols() {
+    std::ifstream file{"/proc/self/exe", std::ios_base::binary};
+    m_image.assign(std::istreambuf_iterator<char>{file}, {});
+
+    Elf64_Ehdr header;
+    if (m_image.size() < sizeof(header)) {
+      return;
+    }
+    std::memcpy(&header, m_image.data(), sizeof(header));
+    if (std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0 ||
+        header.e_ident[EI_CLASS] != ELFCLASS64 ||
+        header.e_shentsize != sizeof(Elf64_Shdr) ||
+        header.e_shoff > m_image.size() ||
+        (m_image.size() - header.e_shoff) / sizeof(Elf64_Shdr) <
+            header.e_shnum) {
+      return;
+    }
+
+    std::vector<Elf64_Shdr> sections(header.e_shnum);
+    std::memcpy(sections.data(), m_image.data() + header.e_shoff,
+                sections.size() * sizeof(Elf64_Shdr));
+
+    u64 bias = _loadBias();
+    for (auto const &section : sections) {
+      if (section.sh_type != SHT_SYMTAB || section.sh_link >= sections.size()) {
+        continue;
+      }
+      auto const &strings = sections[section.sh_link];
+      if (!_contains(section.sh_offset, section.sh_size) ||
+          !_contains(strings.sh_offset, strings.sh_size)) {
+        continue;
+      }
+
+      u64 count = section.sh_size / sizeof(Elf64_Sym);
+      for (u64 n = 0; n < count; n++) {
+        Elf64_Sym symbol;
+        std::memcpy(&symbol,
+                    m_image.data() + section.sh_offset + n * sizeof(symbol),
+                    sizeof(symbol));
+        if (ELF64_ST_TYPE(symbol.st_info) != STT_FUNC || !symbol.st_value ||
+            !symbol.st_size || symbol.st_name >= strings.sh_size) {
+          continue;
+        }
+        m_symbols.push_back(profile_symbol{
+            bias + symbol.st_value, bias + symbol.st_value + symbol.st_size,
+            m_image.data() + strings.sh_offset + symbol.st_name});
+      }
+    }
+    std::sort(m_symbols.begin(), m_symbols.end(),
+              [](auto const &a, auto const &b) { return a.start < b.start; });
+  }
+
+  std::string find(u64 address) const {
+    auto next = std::upper_bound(
+        m_symbols.begin(), m_symbols.end(), address,
+        [](u64 value, auto const &symbol) { return value < symbol.start; });
+    if (next != m_symbols.begin() && address < std::prev(next)->end) {
+      return _demangle(std::prev(next)->name);
+    }
+
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void *>(address), &info)) {
+      if (info.dli_sname) {
+        return _demangle(info.dli_sname);
+      }
+      if (info.dli_fname) {
+        std::string_view path = info.dli_fname;
+        std::string module = "[";
+        module += path.substr(path.rfind('/') + 1);
+        module += ']';
+        return module;
+      }
+    }
+
+    char text[32];
+    std::snprintf(text, sizeof(text), "0x%llx", (unsigned long long)address);
+    return text;
+  }
+
+private:
+  std::vector<char> m_image;
+  std::vector<profile_symbol> m_symbols;
+
+  bool _contains(u64 offset, u64 size) const {
+    return offset <= m_image.size() && m_image.size() - offset >= size;
+  }
+
+  // NOTE: The first object dl_iterate_phdr reports is the executable; its
+  // address is how far a PIE was moved from its link-time addresses.
+  static u64 _loadBias() {
+    u64 bias = 0;
+    dl_iterate_phdr(
+        [](dl_phdr_info *info, size_t, void *data) {
+          *static_cast<u64 *>(data) = info->dlpi_addr;
+          return 1;
+        },
+        &bias);
+    return bias;
+  }
+
+  static std::string _demangle(char const *name) {
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    std::string result = status == 0 && demangled ? demangled : name;
+    std::free(demangled);
+    return result;
+  }
+};
+
+static std::vector<std::pair<std::string, u64>>
+SortCounts(std::unordered_map<std::string, u64> const &counts) {
+  std::vector<std::pair<std::string, u64>> result(counts.begin(),
+                                                  counts.end());
+  std::sort(result.begin(), result.end(), [](auto const &a, auto const &b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+  return result;
+}
+
+void PrintProfileSamples(std::span<char const *const> labels) {
+  if (!GlobalSamples) {
+    return;
+  }
+
+  constexpr u32 MaxFunctions = 20;
+  constexpr u32 MaxFunctionsPerBlock = 5;
+
+  u64 claimed = GlobalSampleCount.load(std::memory_order_relaxed);
+  u64 count = std::min(claimed, GlobalSampleCapacity);
+
+  auto label = [&](u32 anchor) -> std::string {
+    if (anchor < labels.size() && labels[anchor]) {
+      return labels[anchor];
+    }
+    return "anchor " + std::to_string(anchor);
+  };
+
+  ProfileSymbols symbols;
+  std::unordered_map<u64, std::string> names;
+  std::unordered_map<std::string, u64> flat;
+  std::unordered_map<std::string, u64> blockTotal;
+  std::unordered_map<std::string, u64> blockSelf;
+  std::unordered_map<std::string, std::unordered_map<std::string, u64>>
+      blockFunctions;
+  u64 sampleCount = 0;
+  for (u64 n = 0; n < count; n++) {
+    auto const &sample = GlobalSamples[n];
+    u64 rip = std::atomic_ref<u64 const>{sample.rip}.load(
+        std::memory_order_acquire);
+    if (!rip) {
+      continue;
+    }
+    ++sampleCount;
+
+    auto name = names.find(rip);
+    if (name == names.end()) {
+      name = names.emplace(rip, symbols.find(rip)).first;
+    }
+    ++flat[name->second];
+
+    // NOTE: A recursive block counts once per sample in its total.
+    std::string innermost = "(no block)";
+    std::vector<std::string> seen;
+    for (u32 depth = 0; depth < sample.depth; depth++) {
+      auto block = label(sample.stack[depth]);
+      if (std::find(seen.begin(), seen.end(), block) == seen.end()) {
+        ++blockTotal[block];
+        seen.push_back(block);
+      }
+      innermost = block;
+    }
+    ++blockSelf[innermost];
+    ++blockFunctions[innermost][name->second];
+  }
+
+  printf("\nSamples: %llu at %uHz", (unsigned long long)sampleCount,
+         GlobalSampleFrequency);
+  if (claimed > count) {
+    printf(" (%llu dropped, buffer full)",
+           (unsigned long long)(claimed - count));
+  }
+  printf("\n");
+  if (!sampleCount) {
+    return;
+  }
+
+  auto percent = [&](u64 samples) {
+    return 100.0 * (f64)samples / (f64)sampleCount;
+  };
+
+  printf("By function:\n");
+  auto functions = SortCounts(flat);
+  for (u32 n = 0; n < functions.size() && n < MaxFunctions; n++) {
+    printf("  %6.2f%% %8llu  %s\n", percent(functions[n].second),
+           (unsigned long long)functions[n].second,
+           functions[n].first.c_str());
+  }
+
+  // NOTE: "self" is samples where the block was the innermost one open;
+  // the functions listed under it are where those samples landed.
+  printf("By block:\n");
+  if (u64 outside = blockSelf["(no block)"]) {
+    blockTotal.emplace("(no block)", outside);
+  }
+  for (auto const &[block, total] : SortCounts(blockTotal)) {
+    u64 self = blockSelf[block];
+    printf("  %6.2f%% total %6.2f%% self  %s\n", percent(total),
+           percent(self), block.c_str());
+    auto inside = SortCounts(blockFunctions[block]);
+    for (u32 n = 0; n < inside.size() && n < MaxFunctionsPerBlock; n++) {
+      printf("      %6.2f%%  %s\n", percent(inside[n].second),
+             inside[n].first.c_str());
+    }
+  }
+}
+
+#else
+
+void StartProfileSampling(u32, u64) {
+  throw std::runtime_error{"Profile sampling is only supported on x86-64 "
+                           "Linux"};
+}
+
+void StopProfileSampling() {}
+
+void PrintProfileSamples(std::span<char const *const>) {}
+
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <span>
+
+// Internal to the profiler library; StartProfileSampling in profiler.hpp is
+// the public side.
+
+// Disarms the sampling timer, if StartProfileSampling armed it, so printing
+// the report doesn't sample itself.
+void StopProfileSampling();
+// Prints the samples taken so far by function and by open block.
+// labels[anchor] names each anchor, or is null for unused ones.
+void PrintProfileSamples(std::span<char const *const> labels);
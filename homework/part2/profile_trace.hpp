@@ -0,0 +1,44 @@
+#pragma once
+
+#include "types.hpp"
+
+// Binary trace written by WriteProfileTrace and read by
+// profile_trace_to_json. Layout (little-endian):
+//
+//   profile_trace_header
+//   anchorCount x { u32 anchorIndex; u32 labelSize; char label[labelSize]; }
+//   threadCount x { profile_trace_thread; profile_trace_event[eventCount]; }
+//
+// Events of a thread are in the order they happened. When its ring buffer
+// wrapped only the newest ProfileTraceCapacity events survive, so a thread
+// may start with exits whose enters were overwritten.
+inline constexpr u32 ProfileTraceMagic = 0x52545648; // "HVTR"
+inline constexpr u32 ProfileTraceVersion = 1;
+
+// NOTE: Per-thread ring size; a power of two so wrapping is a mask.
+inline constexpr u64 ProfileTraceCapacity = 1 << 16;
+
+// NOTE: Set in profile_trace_event::anchor for block exits.
+inline constexpr u32 ProfileTraceExit = 0x80000000;
+
+struct profile_trace_event {
+  u64 tsc;
+  u32 anchor;
+  u32 thread;
+};
+static_assert(sizeof(profile_trace_event) == 16);
+
+struct profile_trace_header {
+  u32 magic;
+  u32 version;
+  u64 timerFreq;
+  u64 startTsc;
+  u32 anchorCount;
+  u32 threadCount;
+};
+
+struct profile_trace_thread {
+  u32 index;
+  u32 reserved;
+  u64 eventCount;
+};
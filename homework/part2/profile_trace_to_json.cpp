@@ -0,0 +1,142 @@
+#include "profile_trace.hpp"
+#include "types.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Converts a binary profiler trace into Chrome's trace_event JSON, which
+// chrome://tracing and ui.perfetto.dev both open.
+
+template <typename T> static T readValue(std::ifstream &file) {
+  T value;
+  if (!file.read(reinterpret_cast<char *>(&value), sizeof(value))) {
+    throw std::runtime_error{"Truncated trace"};
+  }
+  return value;
+}
+
+// NOTE: JSON-escapes the few characters that can show up in a function or
+// block name.
+static void writeString(std::FILE *out, std::string const &value) {
+  std::fputc('"', out);
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      std::fputc('\\', out);
+      std::fputc(c, out);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      std::fprintf(out, "\\u%04x", c);
+    } else {
+      std::fputc(c, out);
+    }
+  }
+  std::fputc('"', out);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " [trace.bin] [trace.json]\n";
+    return 1;
+  }
+
+  std::ifstream file{argv[1], std::ios_base::binary};
+  if (!file) {
+    throw std::runtime_error{std::string{"Unable to open "} + argv[1]};
+  }
+
+  auto header = readValue<profile_trace_header>(file);
+  if (header.magic != ProfileTraceMagic) {
+    throw std::runtime_error{"Not a profiler trace"};
+  }
+  if (header.version != ProfileTraceVersion) {
+    throw std::runtime_error{"Unsupported trace version " +
+                             std::to_string(header.version)};
+  }
+  if (header.timerFreq == 0) {
+    throw std::runtime_error{"Trace has no timer frequency"};
+  }
+
+  std::map<u32, std::string> labels;
+  for (u32 n = 0; n < header.anchorCount; n++) {
+    auto index = readValue<u32>(file);
+    auto size = readValue<u32>(file);
+    std::string label(size, '\0');
+    if (!file.read(label.data(), size)) {
+      throw std::runtime_error{"Truncated trace"};
+    }
+    labels[index] = std::move(label);
+  }
+
+  std::FILE *out = std::fopen(argv[2], "wb");
+  if (!out) {
+    throw std::runtime_error{std::string{"Unable to create "} + argv[2]};
+  }
+
+  f64 microsecondsPerTick = 1e6 / static_cast<f64>(header.timerFreq);
+  u64 eventCount = 0;
+  u64 droppedCount = 0;
+  char const *separator = "\n";
+  std::fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (u32 t = 0; t < header.threadCount; t++) {
+    auto thread = readValue<profile_trace_thread>(file);
+    std::fprintf(out,
+                 "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+                 "\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}",
+                 separator, thread.index, thread.index);
+    separator = ",\n";
+
+    std::vector<profile_trace_event> events(thread.eventCount);
+    if (!file.read(reinterpret_cast<char *>(events.data()),
+                   events.size() * sizeof(profile_trace_event))) {
+      throw std::runtime_error{"Truncated trace"};
+    }
+
+    // NOTE: A wrapped ring can begin in the middle of blocks. Exits whose
+    // enters were overwritten would unbalance the viewer's stacks, so skip
+    // them.
+    u64 depth = 0;
+    for (auto const &event : events) {
+      bool exit = event.anchor & ProfileTraceExit;
+      u32 anchor = event.anchor & ~ProfileTraceExit;
+      if (exit && depth == 0) {
+        ++droppedCount;
+        continue;
+      }
+      depth = exit ? depth - 1 : depth + 1;
+
+      // NOTE: Signed, in case a thread logged something before BeginProfile.
+      f64 timestamp =
+          static_cast<f64>(static_cast<int64_t>(event.tsc - header.startTsc)) *
+          microsecondsPerTick;
+      auto label = labels.find(anchor);
+      std::fprintf(out, "%s{\"name\":", separator);
+      writeString(out, label != labels.end()
+                           ? label->second
+                           : "anchor " + std::to_string(anchor));
+      std::fprintf(out, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}",
+                   exit ? 'E' : 'B', timestamp, event.thread);
+      ++eventCount;
+    }
+  }
+  std::fprintf(out, "\n]}\n");
+
+  bool failed = std::ferror(out);
+  failed |= std::fclose(out) != 0;
+  if (failed) {
+    throw std::runtime_error{std::string{"Unable to write "} + argv[2]};
+  }
+
+  std::cout << "Threads: " << header.threadCount << '\n'
+            << "Events: " << eventCount << '\n';
+  if (droppedCount) {
+    std::cout << "Dropped " << droppedCount
+              << " exits whose enters were overwritten\n";
+  }
+  return 0;
+}
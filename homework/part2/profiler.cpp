@@ -1,48 +1,697 @@
 #include "profiler.hpp"
 
 #include "metrics.hpp"
+#include "profile_report.hpp"
+#include "profile_sampler.hpp"
+#include "profile_trace.hpp"
 #include "types.hpp"
 
-#include <iomanip>
-#include <iostream>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
+
+struct profiler {
+  u64 start;
+  u64 end;
+};
 
 static profiler GlobalProfiler;
 
-profile_point::profile_point(std::string_view label) : m_start{ReadCPUTimer()} {
-  GlobalProfiler.points[GlobalProfiler.index].label = label;
-  GlobalProfiler.index++;
+struct profile_metadata {
+  std::string key;
+  std::string value;
+  bool number; // NOTE: Written unquoted in JSON
+};
+
+static std::vector<profile_metadata> GlobalProfileMetadata;
+
+static void SetMetadata(std::string_view key, std::string value,
+                        bool number) {
+  for (auto &entry : GlobalProfileMetadata) {
+    if (entry.key == key) {
+      entry.value = std::move(value);
+      entry.number = number;
+      return;
+    }
+  }
+  GlobalProfileMetadata.push_back(
+      profile_metadata{std::string{key}, std::move(value), number});
+}
+
+#if PROFILER
+
+constinit thread_local profile_thread *GlobalProfilerThread = nullptr;
+
+// NOTE: Tables are owned here rather than by their threads, so they outlive
+// the workers and can still be merged after they exit.
+static std::mutex GlobalProfilerThreadsMutex;
+static std::vector<std::unique_ptr<profile_thread>> GlobalProfilerThreads;
+
+using profile_anchors = std::array<profile_anchor, MaxProfileAnchors>;
+
+#if PROFILER_HISTOGRAMS
+static u64 GlobalProfileSampleCapacity = 0;
+#endif
+
+#if PROFILER_ANCHOR_SECTION
+
+// NOTE: Every site in the program, in anchor order starting at anchor 1.
+static std::span<profile_anchor_site const> GetProfileAnchorSites() {
+  if (!__start_profile_anchor_sites) {
+    return {};
+  }
+  return {__start_profile_anchor_sites, __stop_profile_anchor_sites};
+}
+
+// NOTE: The table is fixed at link time, so one check up front covers every
+// later hit.
+static void CheckProfileAnchorSites() {
+  auto bytes = reinterpret_cast<char const *>(__stop_profile_anchor_sites) -
+               reinterpret_cast<char const *>(__start_profile_anchor_sites);
+  if (bytes % sizeof(profile_anchor_site) != 0) {
+    throw std::runtime_error{"Profile anchor sites are not a packed array"};
+  }
+  if (GetProfileAnchorSites().size() >= MaxProfileAnchors) {
+    throw std::runtime_error{
+        "Number of profile points exceeds MaxProfileAnchors"};
+  }
+}
+
+#else
+
+// NOTE: Sites in the order they were first hit; guarded by
+// GlobalProfilerThreadsMutex.
+static std::vector<profile_anchor_site const *> GlobalProfileAnchorSites;
+
+u32 RegisterProfileAnchor(profile_anchor_site &site) {
+  std::lock_guard lock{GlobalProfilerThreadsMutex};
+  if (u32 index = site.index.load(std::memory_order_relaxed)) {
+    return index;
+  }
+  if (GlobalProfileAnchorSites.size() + 1 >= MaxProfileAnchors) {
+    throw std::runtime_error{
+        "Number of profile points exceeds MaxProfileAnchors"};
+  }
+  GlobalProfileAnchorSites.push_back(&site);
+  auto index = static_cast<u32>(GlobalProfileAnchorSites.size());
+  site.index.store(index, std::memory_order_release);
+  return index;
+}
+
+static void CheckProfileAnchorSites() {}
+
+#endif
+
+// NOTE: Indexed by anchor, with null for anchor 0 and unused slots. Caller
+// holds GlobalProfilerThreadsMutex.
+static std::vector<char const *> GetAnchorLabels() {
+  std::vector<char const *> labels(MaxProfileAnchors);
+#if PROFILER_ANCHOR_SECTION
+  auto sites = GetProfileAnchorSites();
+  for (u64 n = 0; n < sites.size() && n + 1 < MaxProfileAnchors; n++) {
+    labels[n + 1] = sites[n].label;
+  }
+#else
+  for (u64 n = 0; n < GlobalProfileAnchorSites.size(); n++) {
+    labels[n + 1] = GlobalProfileAnchorSites[n]->label;
+  }
+#endif
+  return labels;
+}
+
+profile_thread *RegisterProfileThread() {
+  CheckProfileAnchorSites();
+  auto thread = std::make_unique<profile_thread>();
+  std::lock_guard lock{GlobalProfilerThreadsMutex};
+#if PROFILER_HISTOGRAMS
+  thread->samples.resize(GlobalProfileSampleCapacity);
+#endif
+  thread->index = static_cast<u32>(GlobalProfilerThreads.size());
+  GlobalProfilerThread = thread.get();
+  GlobalProfilerThreads.push_back(std::move(thread));
+  return GlobalProfilerThread;
+}
+
+struct profile_percentiles {
+  u64 p50;
+  u64 p90;
+  u64 p99;
+  u64 max;
+  bool exact;
+};
+
+// NOTE: Raw per-hit durations of each anchor, filled only when every hit of
+// that anchor was sampled; anything less would skew the percentiles.
+using profile_anchor_samples = std::vector<std::vector<u64>>;
+
+#if PROFILER_HISTOGRAMS
+
+static u64 GetProfileHistogramBucketLimit(u32 bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+  u32 exponent = bucket / 4 + 1;
+  u64 start = static_cast<u64>(4 + bucket % 4) << (exponent - 2);
+  return start + (u64{1} << (exponent - 2)) - 1;
+}
+
+static profile_anchor_samples
+CollectSamples(std::span<std::unique_ptr<profile_thread> const> threads,
+               profile_anchors const &anchors) {
+  profile_anchor_samples result(MaxProfileAnchors);
+  for (auto const &thread : threads) {
+    u64 count = std::min<u64>(thread->sampleCount, thread->samples.size());
+    for (u64 n = 0; n < count; n++) {
+      auto const &sample = thread->samples[n];
+      result[sample.anchor].push_back(sample.tscElapsed);
+    }
+  }
+  for (u32 index = 0; index < MaxProfileAnchors; index++) {
+    if (result[index].size() != anchors[index].hitCount) {
+      result[index].clear();
+    }
+  }
+  return result;
+}
+
+// NOTE: Without exact samples a percentile is the last cycle count of the
+// bucket it falls in, so it overstates by at most a bucket width (25%).
+static profile_percentiles GetPercentiles(profile_anchor const &anchor,
+                                          std::vector<u64> samples) {
+  profile_percentiles result{};
+  result.max = anchor.tscElapsedMax;
+  if (!anchor.hitCount) {
+    return result;
+  }
+
+  auto rank = [&](f64 fraction) {
+    return std::max<u64>(
+        1, static_cast<u64>(std::ceil(fraction * (f64)anchor.hitCount)));
+  };
+  std::array<u64 *, 3> values{&result.p50, &result.p90, &result.p99};
+  std::array<f64, 3> fractions{0.50, 0.90, 0.99};
+
+  if (!samples.empty()) {
+    result.exact = true;
+    std::sort(samples.begin(), samples.end());
+    for (u32 n = 0; n < values.size(); n++) {
+      *values[n] = samples[rank(fractions[n]) - 1];
+    }
+    return result;
+  }
+
+  for (u32 n = 0; n < values.size(); n++) {
+    u64 target = rank(fractions[n]);
+    u64 seen = 0;
+    for (u32 bucket = 0; bucket < ProfileHistogramBucketCount; bucket++) {
+      seen += anchor.histogram[bucket];
+      if (seen >= target) {
+        *values[n] =
+            std::min(GetProfileHistogramBucketLimit(bucket), result.max);
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+static void PrintPercentiles(u64 timerFreq,
+                             profile_percentiles const &percentiles) {
+  // NOTE: Tail latency reads better as time than as cycles.
+  auto print = [&](char const *name, u64 cycles) {
+    if (timerFreq) {
+      printf("%s %.3fus  ", name, 1e6 * (f64)cycles / (f64)timerFreq);
+    } else {
+      printf("%s %llu  ", name, (unsigned long long)cycles);
+    }
+  };
+  printf("    ");
+  print("p50", percentiles.p50);
+  print("p90", percentiles.p90);
+  print("p99", percentiles.p99);
+  print("max", percentiles.max);
+  printf("%s\n", percentiles.exact ? "(exact)" : "(histogram)");
+}
+
+#else
+
+static profile_anchor_samples
+CollectSamples(std::span<std::unique_ptr<profile_thread> const>,
+               profile_anchors const &) {
+  return profile_anchor_samples(MaxProfileAnchors);
+}
+
+static profile_percentiles GetPercentiles(profile_anchor const &,
+                                          std::vector<u64>) {
+  return {};
+}
+
+#endif
+
+static void PrintTimeElapsed(u64 totalTscElapsed, u64 timerFreq,
+                             char const *label, profile_anchor const &anchor) {
+  f64 percent =
+      100.0 * ((f64)anchor.tscElapsedExclusive / (f64)totalTscElapsed);
+  printf("  %s[%llu]: %llu (%.2f%%", label,
+         (unsigned long long)anchor.hitCount,
+         (unsigned long long)anchor.tscElapsedExclusive, percent);
+  if (anchor.tscElapsedInclusive != anchor.tscElapsedExclusive) {
+    f64 percentWithChildren =
+        100.0 * ((f64)anchor.tscElapsedInclusive / (f64)totalTscElapsed);
+    printf(", %.2f%% w/children", percentWithChildren);
+  }
+  printf(")");
+
+  if (anchor.processedByteCount && timerFreq) {
+    f64 megabyte = 1024.0 * 1024.0;
+    f64 gigabyte = megabyte * 1024.0;
+
+    f64 seconds = (f64)anchor.tscElapsedInclusive / (f64)timerFreq;
+    f64 bytesPerSecond = (f64)anchor.processedByteCount / seconds;
+    f64 megabytes = (f64)anchor.processedByteCount / megabyte;
+    f64 gigabytesPerSecond = bytesPerSecond / gigabyte;
+
+    printf("  %.3fmb at %.2fgb/s", megabytes, gigabytesPerSecond);
+  }
+
+  printf("\n");
+}
+
+#if PROFILER_COUNTERS
+
+// NOTE: Cycles here are core cycles from the PMU, not TSC ticks, so IPC is
+// right even when the core runs above or below the TSC frequency. Misses
+// are per thousand instructions so blocks of different sizes compare.
+static void PrintCounters(profile_anchor const &anchor,
+                          PerfCounters const &available) {
+  f64 instructions =
+      (f64)getPerfCounter(anchor.counters, perf_counter::Instructions);
+  f64 cycles = (f64)getPerfCounter(anchor.counters, perf_counter::Cycles);
+  if (instructions == 0) {
+    return;
+  }
+
+  printf("    ");
+  if (available.available(perf_counter::Cycles) && cycles) {
+    printf("ipc %.2f  ", instructions / cycles);
+  }
+  for (auto counter : {perf_counter::L1DMisses, perf_counter::LLCMisses,
+                       perf_counter::BranchMisses}) {
+    if (available.available(counter)) {
+      f64 misses = (f64)getPerfCounter(anchor.counters, counter);
+      printf("%s %.2f/ki  ", getPerfCounterName(counter),
+             1000.0 * misses / instructions);
+    }
+  }
+  printf("\n");
 }
 
-profile_point::~profile_point() {
-  u64 elapsed = ReadCPUTimer() - m_start;
-  GlobalProfiler.points[GlobalProfiler.index].time = elapsed;
+#endif
+
+static void PrintAnchorData(u64 totalTscElapsed, u64 timerFreq,
+                            std::span<char const *const> labels,
+                            profile_anchors const &anchors,
+                            profile_anchor_samples const &samples) {
+  for (u32 index = 0; index < MaxProfileAnchors; index++) {
+    auto const &anchor = anchors[index];
+    if (anchor.tscElapsedInclusive) {
+      PrintTimeElapsed(totalTscElapsed, timerFreq, labels[index], anchor);
+#if PROFILER_COUNTERS
+      PrintCounters(anchor, GlobalProfilerThreads[0]->counters);
+#endif
+#if PROFILER_HISTOGRAMS
+      PrintPercentiles(timerFreq, GetPercentiles(anchor, samples[index]));
+#else
+      (void)samples;
+#endif
+    }
+  }
 }
 
-void BeginProfile() { GlobalProfiler.start = ReadCPUTimer(); }
+// NOTE: Sums every thread's table. Caller holds GlobalProfilerThreadsMutex.
+static std::unique_ptr<profile_anchors> MergeAnchors() {
+  auto merged = std::make_unique<profile_anchors>();
+  for (auto const &thread : GlobalProfilerThreads) {
+    for (u32 index = 0; index < MaxProfileAnchors; index++) {
+      auto const &anchor = thread->anchors[index];
+      auto &total = (*merged)[index];
+      total.tscElapsedExclusive += anchor.tscElapsedExclusive;
+      total.tscElapsedInclusive += anchor.tscElapsedInclusive;
+      total.hitCount += anchor.hitCount;
+      total.processedByteCount += anchor.processedByteCount;
+#if PROFILER_COUNTERS
+      for (u32 counter = 0; counter < PerfCounterCount; counter++) {
+        total.counters[counter] += anchor.counters[counter];
+      }
+#endif
+#if PROFILER_HISTOGRAMS
+      total.tscElapsedMax =
+          std::max(total.tscElapsedMax, anchor.tscElapsedMax);
+      for (u32 bucket = 0; bucket < ProfileHistogramBucketCount; bucket++) {
+        total.histogram[bucket] += anchor.histogram[bucket];
+      }
+#endif
+    }
+  }
+  return merged;
+}
+
+static void PrintAnchorData(u64 totalTscElapsed, u64 timerFreq) {
+  std::lock_guard lock{GlobalProfilerThreadsMutex};
+#if PROFILER_COUNTERS
+  if (!GlobalProfilerThreads.empty()) {
+    auto const &counters = GlobalProfilerThreads[0]->counters;
+    if (!counters.error().empty()) {
+      printf("Hardware counters %s: %s\n",
+             counters.anyAvailable() ? "incomplete" : "unavailable",
+             counters.error().c_str());
+    }
+  }
+#endif
+  std::span<std::unique_ptr<profile_thread> const> threads{
+      GlobalProfilerThreads};
+  auto labels = GetAnchorLabels();
+  if (threads.size() == 1) {
+    auto const &anchors = threads[0]->anchors;
+    PrintAnchorData(totalTscElapsed, timerFreq, labels, anchors,
+                    CollectSamples(threads, anchors));
+    return;
+  }
+
+  // NOTE: Each thread's exclusive times add up to at most its own run time,
+  // so percentages here are relative to wall time and the aggregate can
+  // exceed 100% when threads ran concurrently.
+  for (u64 n = 0; n < threads.size(); n++) {
+    auto const &anchors = threads[n]->anchors;
+    printf("Thread %u:\n", threads[n]->index);
+    PrintAnchorData(totalTscElapsed, timerFreq, labels, anchors,
+                    CollectSamples(threads.subspan(n, 1), anchors));
+  }
 
-#define TimeBlock(Name)                                                        \
-  profile_point { Name }
-#define TimeFunction TimeBlock(__func__)
+  if (!threads.empty()) {
+    auto merged = MergeAnchors();
+    printf("All %zu threads:\n", threads.size());
+    PrintAnchorData(totalTscElapsed, timerFreq, labels, *merged,
+                    CollectSamples(threads, *merged));
+  }
+}
 
-void print(std::string_view desc, u64 elapsed, u64 begin, u64 end) {
-  std::cout << std::setprecision(2) << desc << ": " << (end - begin) << " ("
-            << 100.f * (end - begin) / elapsed << "%)\n";
+static void WriteReportLabel(std::FILE *out, char const *label) {
+  std::fputc('"', out);
+  for (char const *c = label; *c; c++) {
+    if (*c == '"') {
+      std::fputc('"', out);
+    }
+    std::fputc(*c, out);
+  }
+  std::fputc('"', out);
+}
+
+static void WriteJsonString(std::FILE *out, std::string_view value) {
+  std::fputc('"', out);
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      std::fputc('\\', out);
+      std::fputc(c, out);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      std::fprintf(out, "\\u%04x", c);
+    } else {
+      std::fputc(c, out);
+    }
+  }
+  std::fputc('"', out);
+}
+
+struct profile_report_row {
+  char const *label;
+  profile_anchor const *anchor;
+  profile_percentiles percentiles;
+  u64 bytesPerSecond;
+};
+
+static void WriteCsvReport(std::FILE *out,
+                           std::span<profile_metadata const> metadata,
+                           std::span<profile_report_row const> rows) {
+  std::fprintf(out, "# profile report %u\n", ProfileReportVersion);
+  for (auto const &entry : metadata) {
+    std::fprintf(out, "# %s=%s\n", entry.key.c_str(), entry.value.c_str());
+  }
+  std::fprintf(out, "%s\n", ProfileReportColumns);
+  for (auto const &row : rows) {
+    WriteReportLabel(out, row.label);
+    std::fprintf(out, ",%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                 (unsigned long long)row.anchor->hitCount,
+                 (unsigned long long)row.anchor->tscElapsedExclusive,
+                 (unsigned long long)row.anchor->tscElapsedInclusive,
+                 (unsigned long long)row.anchor->processedByteCount,
+                 (unsigned long long)row.percentiles.p50,
+                 (unsigned long long)row.percentiles.p90,
+                 (unsigned long long)row.percentiles.p99,
+                 (unsigned long long)row.percentiles.max,
+                 (unsigned long long)row.bytesPerSecond);
+  }
+}
+
+static void WriteJsonReport(std::FILE *out,
+                            std::span<profile_metadata const> metadata,
+                            std::span<profile_report_row const> rows) {
+  std::fprintf(out, "{\"version\": %u,\n\"metadata\": {",
+               ProfileReportVersion);
+  for (u64 n = 0; n < metadata.size(); n++) {
+    std::fprintf(out, "%s\n  ", n ? "," : "");
+    WriteJsonString(out, metadata[n].key);
+    std::fprintf(out, ": ");
+    if (metadata[n].number) {
+      std::fprintf(out, "%s", metadata[n].value.c_str());
+    } else {
+      WriteJsonString(out, metadata[n].value);
+    }
+  }
+  std::fprintf(out, "},\n\"anchors\": [");
+  for (u64 n = 0; n < rows.size(); n++) {
+    auto const &row = rows[n];
+    std::fprintf(out, "%s\n  {\"label\": ", n ? "," : "");
+    WriteJsonString(out, row.label);
+    std::fprintf(out,
+                 ", \"hits\": %llu, \"exclusive_cycles\": %llu, "
+                 "\"inclusive_cycles\": %llu, \"bytes\": %llu, "
+                 "\"p50_cycles\": %llu, \"p90_cycles\": %llu, "
+                 "\"p99_cycles\": %llu, \"max_cycles\": %llu, "
+                 "\"bytes_per_second\": %llu}",
+                 (unsigned long long)row.anchor->hitCount,
+                 (unsigned long long)row.anchor->tscElapsedExclusive,
+                 (unsigned long long)row.anchor->tscElapsedInclusive,
+                 (unsigned long long)row.anchor->processedByteCount,
+                 (unsigned long long)row.percentiles.p50,
+                 (unsigned long long)row.percentiles.p90,
+                 (unsigned long long)row.percentiles.p99,
+                 (unsigned long long)row.percentiles.max,
+                 (unsigned long long)row.bytesPerSecond);
+  }
+  std::fprintf(out, "\n]}\n");
+}
+
+static void WriteReport(std::FILE *out, u64 timerFreq,
+                        profile_report_format format) {
+  std::lock_guard lock{GlobalProfilerThreadsMutex};
+  auto merged = MergeAnchors();
+  auto samples = CollectSamples(GlobalProfilerThreads, *merged);
+  auto labels = GetAnchorLabels();
+
+  // NOTE: timer_freq comes first; profile_compare needs it to turn cycles
+  // into time.
+  std::vector<profile_metadata> metadata{
+      {"timer_freq", std::to_string(timerFreq), true},
+      {"timer_freq_source", GetCPUFreqSource(), false},
+      {"cpu", GetCPUBrand(), false},
+      {"threads", std::to_string(GlobalProfilerThreads.size()), true}};
+  if (GlobalProfiler.end > GlobalProfiler.start) {
+    metadata.push_back({"total_cycles",
+                        std::to_string(GlobalProfiler.end -
+                                       GlobalProfiler.start),
+                        true});
+  }
+  metadata.insert(metadata.end(), GlobalProfileMetadata.begin(),
+                  GlobalProfileMetadata.end());
+
+  std::vector<profile_report_row> rows;
+  for (u32 index = 0; index < MaxProfileAnchors; index++) {
+    auto const &anchor = (*merged)[index];
+    if (!anchor.hitCount) {
+      continue;
+    }
+    u64 bytesPerSecond = 0;
+    if (anchor.processedByteCount && anchor.tscElapsedInclusive) {
+      bytesPerSecond = static_cast<u64>((f64)anchor.processedByteCount *
+                                        (f64)timerFreq /
+                                        (f64)anchor.tscElapsedInclusive);
+    }
+    rows.push_back(profile_report_row{labels[index], &anchor,
+                                      GetPercentiles(anchor, samples[index]),
+                                      bytesPerSecond});
+  }
+
+  if (format == profile_report_format::Json) {
+    WriteJsonReport(out, metadata, rows);
+  } else {
+    WriteCsvReport(out, metadata, rows);
+  }
+}
+
+#endif
+
+#if PROFILER && PROFILER_TRACE
+
+static void WriteTrace(std::ofstream &file, u64 timerFreq) {
+  std::lock_guard lock{GlobalProfilerThreadsMutex};
+
+  std::vector<std::pair<u32, std::string_view>> labels;
+  auto anchorLabels = GetAnchorLabels();
+  for (u32 index = 0; index < MaxProfileAnchors; index++) {
+    if (anchorLabels[index]) {
+      labels.emplace_back(index, anchorLabels[index]);
+    }
+  }
+
+  profile_trace_header header{};
+  header.magic = ProfileTraceMagic;
+  header.version = ProfileTraceVersion;
+  header.timerFreq = timerFreq;
+  header.startTsc = GlobalProfiler.start;
+  header.anchorCount = static_cast<u32>(labels.size());
+  header.threadCount = static_cast<u32>(GlobalProfilerThreads.size());
+  file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+
+  for (auto [index, label] : labels) {
+    u32 size = static_cast<u32>(label.size());
+    file.write(reinterpret_cast<char const *>(&index), sizeof(index));
+    file.write(reinterpret_cast<char const *>(&size), sizeof(size));
+    file.write(label.data(), size);
+  }
+
+  for (auto const &thread : GlobalProfilerThreads) {
+    u64 count = std::min(thread->traceCount, ProfileTraceCapacity);
+    u64 first = thread->traceCount - count;
+    profile_trace_thread info{thread->index, 0, count};
+    file.write(reinterpret_cast<char const *>(&info), sizeof(info));
+
+    // NOTE: Oldest surviving event first, which may mean writing the ring
+    // in two pieces.
+    u64 head = first & (ProfileTraceCapacity - 1);
+    u64 tail = std::min(count, ProfileTraceCapacity - head);
+    file.write(reinterpret_cast<char const *>(thread->trace.data() + head),
+               tail * sizeof(profile_trace_event));
+    file.write(reinterpret_cast<char const *>(thread->trace.data()),
+               (count - tail) * sizeof(profile_trace_event));
+  }
+}
+
+#endif
+
+#if !PROFILER
+
+static void PrintAnchorData(u64, u64) {}
+
+#endif
+
+void BeginProfile() {
+#if PROFILER
+  // NOTE: Register the calling thread first so it shows up as thread 0.
+  GetProfileThread();
+#endif
+  GlobalProfiler.start = ReadCPUTimer();
 }
 
 void EndAndPrintProfile() {
   GlobalProfiler.end = ReadCPUTimer();
+  StopProfileSampling();
 
   u64 CPUFreq = GetCPUFreq();
   u64 TotalCPUElapsed = GlobalProfiler.end - GlobalProfiler.start;
   if (CPUFreq) {
-    printf("\nTotal time: %0.4fms (CPU freq %llu)\n",
-           1000.0 * (f64)TotalCPUElapsed / (f64)CPUFreq, CPUFreq);
+    printf("\nTotal time: %0.4fms (CPU freq %llu, %s)\n",
+           1000.0 * (f64)TotalCPUElapsed / (f64)CPUFreq,
+           (unsigned long long)CPUFreq, GetCPUFreqSource());
   }
 
-  u64 prev_time = GlobalProfiler.start;
-  for (auto const &point : GlobalProfiler.points) {
-    print(point.label, TotalCPUElapsed, point.time, prev_time);
-    prev_time = point.time;
+  PrintAnchorData(TotalCPUElapsed, CPUFreq);
+
+#if PROFILER
+  std::vector<char const *> labels;
+  {
+    std::lock_guard lock{GlobalProfilerThreadsMutex};
+    labels = GetAnchorLabels();
+  }
+  PrintProfileSamples(labels);
+#else
+  PrintProfileSamples({});
+#endif
+}
+
+void SetProfileSampleCapacity(u64 samplesPerThread) {
+#if PROFILER && PROFILER_HISTOGRAMS
+  std::lock_guard lock{GlobalProfilerThreadsMutex};
+  GlobalProfileSampleCapacity = samplesPerThread;
+  for (auto const &thread : GlobalProfilerThreads) {
+    thread->samples.resize(samplesPerThread);
+    thread->sampleCount = 0;
+  }
+#else
+  (void)samplesPerThread;
+  throw std::runtime_error{"Built without PROFILER_HISTOGRAMS"};
+#endif
+}
+
+void SetProfileMetadata(std::string_view key, std::string_view value) {
+  SetMetadata(key, std::string{value}, false);
+}
+
+void SetProfileMetadata(std::string_view key, u64 value) {
+  SetMetadata(key, std::to_string(value), true);
+}
+
+void WriteProfileReport(char const *path, profile_report_format format) {
+#if PROFILER
+  std::FILE *out = std::fopen(path, "wb");
+  if (!out) {
+    throw std::runtime_error{std::string{"Unable to create "} + path};
+  }
+  WriteReport(out, GetCPUFreq(), format);
+  bool failed = std::ferror(out);
+  failed |= std::fclose(out) != 0;
+  if (failed) {
+    throw std::runtime_error{std::string{"Unable to write "} + path};
+  }
+#else
+  (void)path;
+  (void)format;
+  throw std::runtime_error{"Built without PROFILER"};
+#endif
+}
+
+void WriteProfileTrace(char const *path) {
+#if PROFILER && PROFILER_TRACE
+  std::ofstream file{path, std::ios_base::binary};
+  if (!file) {
+    throw std::runtime_error{std::string{"Unable to create "} + path};
+  }
+  WriteTrace(file, GetCPUFreq());
+  if (!file) {
+    throw std::runtime_error{std::string{"Unable to write "} + path};
   }
+#else
+  (void)path;
+  throw std::runtime_error{"Built without PROFILER_TRACE"};
+#endif
 }
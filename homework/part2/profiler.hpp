@@ -1,36 +1,344 @@
+#pragma once
+
+#include "metrics.hpp"
+#include "perf_counters.hpp"
+#include "profile_trace.hpp"
 #include "types.hpp"
 
 #include <array>
-#include <iomanip>
-#include <iostream>
+#include <atomic>
+#include <bit>
 #include <string_view>
+#include <vector>
+
+// Build with PROFILER=1 to record anchors. With PROFILER=0 every TimeBlock
+// and TimeFunction compiles to nothing and only the total time is reported.
+#ifndef PROFILER
+#define PROFILER 0
+#endif
+
+// Build with PROFILER_TRACE=1 (on top of PROFILER=1) to also log every block
+// enter and exit into a per-thread ring buffer for WriteProfileTrace.
+#ifndef PROFILER_TRACE
+#define PROFILER_TRACE 0
+#endif
+
+// Build with PROFILER_COUNTERS=1 (on top of PROFILER=1) to also read the
+// hardware counters in PerfCounters on every block enter and exit, so the
+// report can show IPC and miss rates per anchor.
+#ifndef PROFILER_COUNTERS
+#define PROFILER_COUNTERS 0
+#endif
+
+// Build with PROFILER_HISTOGRAMS=1 (on top of PROFILER=1) to also bucket
+// the duration of every hit per anchor, so the report can show p50/p90/p99
+// and max. SetProfileSampleCapacity additionally keeps raw per-hit
+// durations for exact percentiles.
+#ifndef PROFILER_HISTOGRAMS
+#define PROFILER_HISTOGRAMS 0
+#endif
+
+// Build with PROFILER_SAMPLING=1 (on top of PROFILER=1) to keep the stack of
+// open anchors per thread, so StartProfileSampling can attribute samples to
+// every enclosing block rather than only the innermost one.
+#ifndef PROFILER_SAMPLING
+#define PROFILER_SAMPLING 0
+#endif
+
+// NOTE: Open anchors recorded per sample; deeper blocks are still timed but
+// samples only see the outermost ones.
+inline constexpr u32 ProfileSampleStackDepth = 13;
+
+// One timer-signal sample: where the thread was and which blocks were open,
+// outermost first.
+struct profile_sample_event {
+  u64 rip;
+  u32 depth;
+  u32 stack[ProfileSampleStackDepth];
+};
+static_assert(sizeof(profile_sample_event) == 64);
+
+#if PROFILER
+
+#if PROFILER_HISTOGRAMS
 
-struct measure {
-  u64 time;
-  std::string_view label;
+// NOTE: Four buckets per power of two, so a bucket is at most 25% wide.
+// Durations below 4 cycles get a bucket each.
+inline constexpr u32 ProfileHistogramBucketCount = 256;
+
+inline u32 GetProfileHistogramBucket(u64 elapsed) {
+  if (elapsed < 4) {
+    return static_cast<u32>(elapsed);
+  }
+  u32 exponent = static_cast<u32>(std::bit_width(elapsed)) - 1;
+  return (exponent - 1) * 4 + static_cast<u32>((elapsed >> (exponent - 2)) & 3);
+}
+
+struct profile_sample {
+  u64 tscElapsed;
+  u32 anchor;
 };
 
-struct profiler {
-  std::array<measure, 4096> points;
-  u64 start;
-  u64 end;
-  size_t index = 0;
+#endif
+
+// Static description of one TimeBlock site. With GCC or Clang on ELF the
+// macros put every site in the profile_anchor_sites section, which the
+// linker lays out as one array across all translation units. A site's
+// anchor index is then its position in that array, so indices are dense and
+// unique program-wide and labels never have to be written at run time.
+// Other toolchains hand out indices on first hit instead.
+#ifndef PROFILER_ANCHOR_SECTION
+#if defined(__ELF__) && (defined(__GNUC__) || defined(__clang__))
+#define PROFILER_ANCHOR_SECTION 1
+#else
+#define PROFILER_ANCHOR_SECTION 0
+#endif
+#endif
+
+struct profile_anchor_site {
+  char const *label;
+#if !PROFILER_ANCHOR_SECTION
+  std::atomic<u32> index{}; // NOTE: 0 until the site is first hit
+#endif
 };
 
-class profile_point {
+#if PROFILER_ANCHOR_SECTION
+
+// NOTE: Defined by the linker; weak so a program without any TimeBlock
+// still links.
+extern "C" {
+__attribute__((weak)) extern profile_anchor_site __start_profile_anchor_sites[];
+__attribute__((weak)) extern profile_anchor_site __stop_profile_anchor_sites[];
+}
+
+#define ProfileAnchorSiteAttributes                                            \
+  __attribute__((section("profile_anchor_sites"), used))
+
+// NOTE: Anchor 0 is never handed out; it stands for "no parent" so blocks at
+// the top level have somewhere harmless to subtract their time from.
+inline u32 GetProfileAnchorIndex(profile_anchor_site &site) {
+  return static_cast<u32>(&site - __start_profile_anchor_sites) + 1;
+}
+
+#else
+
+#define ProfileAnchorSiteAttributes
+
+// Slow path of GetProfileAnchorIndex: numbers the site the first time any
+// thread hits it.
+u32 RegisterProfileAnchor(profile_anchor_site &site);
+
+inline u32 GetProfileAnchorIndex(profile_anchor_site &site) {
+  u32 index = site.index.load(std::memory_order_acquire);
+  return index ? index : RegisterProfileAnchor(site);
+}
+
+#endif
+
+struct profile_anchor {
+  u64 tscElapsedExclusive; // NOTE: Does NOT include children
+  u64 tscElapsedInclusive; // NOTE: DOES include children
+  u64 hitCount;
+  u64 processedByteCount;
+#if PROFILER_COUNTERS
+  perf_counter_values counters; // NOTE: DOES include children
+#endif
+#if PROFILER_HISTOGRAMS
+  u64 tscElapsedMax; // NOTE: Longest single hit, with children
+  std::array<u32, ProfileHistogramBucketCount> histogram;
+#endif
+};
+
+// NOTE: Sites beyond this make RegisterProfileThread (or, without the
+// section, RegisterProfileAnchor) throw.
+inline constexpr u32 MaxProfileAnchors = 4096;
+
+// Anchor table of one thread. Every thread that opens a block gets its own,
+// so threads never write to shared counters; EndAndPrintProfile merges them.
+struct profile_thread {
+  std::array<profile_anchor, MaxProfileAnchors> anchors;
+  u32 parent;
+  u32 index; // NOTE: Registration order, the main thread is usually 0
+#if PROFILER_COUNTERS
+  PerfCounters counters;
+#endif
+#if PROFILER_TRACE
+  u64 traceCount; // NOTE: Events ever written; the ring holds the last ones
+  std::array<profile_trace_event, ProfileTraceCapacity> trace;
+#endif
+#if PROFILER_HISTOGRAMS
+  u64 sampleCount; // NOTE: Hits ever seen; only the first samples.size() kept
+  std::vector<profile_sample> samples;
+#endif
+#if PROFILER_SAMPLING
+  u32 depth; // NOTE: Open blocks, may exceed ProfileSampleStackDepth
+  std::array<u32, ProfileSampleStackDepth> stack;
+#endif
+};
+
+extern constinit thread_local profile_thread *GlobalProfilerThread;
+
+// Slow path of GetProfileThread: allocates and registers the calling
+// thread's table the first time it opens a block.
+profile_thread *RegisterProfileThread();
+
+inline profile_thread &GetProfileThread() {
+  profile_thread *thread = GlobalProfilerThread;
+  if (!thread) {
+    thread = RegisterProfileThread();
+  }
+  return *thread;
+}
+
+#if PROFILER_TRACE
+inline void TraceProfileEvent(profile_thread &thread, u64 tsc, u32 anchor) {
+  thread.trace[thread.traceCount++ & (ProfileTraceCapacity - 1)] =
+      profile_trace_event{tsc, anchor, thread.index};
+}
+#endif
+
+// Times the enclosing scope into the anchor of its site. Defined here so the
+// constructor and destructor inline into the measured code.
+class profile_block {
+  profile_thread *m_thread;
+  u64 m_oldTscElapsedInclusive;
   u64 m_start;
-  size_t m_index;
+  u32 m_parentIndex;
+  u32 m_anchorIndex;
+#if PROFILER_COUNTERS
+  perf_counter_values m_oldCounters;
+  perf_counter_values m_startCounters;
+#endif
 
 public:
-  profile_point(std::string_view label);
-  ~profile_point();
+  profile_block(profile_anchor_site &site, u64 byteCount)
+      : m_thread{&GetProfileThread()}, m_parentIndex{m_thread->parent},
+        m_anchorIndex{GetProfileAnchorIndex(site)} {
+    // NOTE: Everything that doesn't depend on the elapsed time is done here,
+    // keeping the exit down to the parent restore and the time updates.
+    auto &anchor = m_thread->anchors[m_anchorIndex];
+    ++anchor.hitCount;
+    anchor.processedByteCount += byteCount;
+    // NOTE: Saving the old inclusive time and overwriting it on exit, rather
+    // than adding to it, keeps recursive blocks from counting the same
+    // cycles more than once.
+    m_oldTscElapsedInclusive = anchor.tscElapsedInclusive;
+    m_thread->parent = m_anchorIndex;
+#if PROFILER_SAMPLING
+    // NOTE: The entry has to be in place before depth covers it, or a signal
+    // landing in between would read a stale anchor.
+    if (m_thread->depth < ProfileSampleStackDepth) {
+      m_thread->stack[m_thread->depth] = m_anchorIndex;
+    }
+    std::atomic_signal_fence(std::memory_order_release);
+    ++m_thread->depth;
+#endif
+#if PROFILER_COUNTERS
+    // NOTE: Counters are read outside the timer reads, so their cost isn't
+    // charged to the block's cycles.
+    m_oldCounters = anchor.counters;
+    m_startCounters = m_thread->counters.read();
+#endif
+    m_start = ReadCPUTimer();
+#if PROFILER_TRACE
+    TraceProfileEvent(*m_thread, m_start, m_anchorIndex);
+#endif
+  }
+
+  ~profile_block() {
+    u64 end = ReadCPUTimer();
+    u64 elapsed = end - m_start;
+#if PROFILER_COUNTERS
+    perf_counter_values endCounters = m_thread->counters.read();
+#endif
+#if PROFILER_TRACE
+    TraceProfileEvent(*m_thread, end, m_anchorIndex | ProfileTraceExit);
+#endif
+    m_thread->parent = m_parentIndex;
+#if PROFILER_SAMPLING
+    --m_thread->depth;
+#endif
+
+    auto &parent = m_thread->anchors[m_parentIndex];
+    auto &anchor = m_thread->anchors[m_anchorIndex];
+    parent.tscElapsedExclusive -= elapsed;
+    anchor.tscElapsedExclusive += elapsed;
+    anchor.tscElapsedInclusive = m_oldTscElapsedInclusive + elapsed;
+#if PROFILER_COUNTERS
+    for (u32 index = 0; index < PerfCounterCount; index++) {
+      anchor.counters[index] =
+          m_oldCounters[index] + endCounters[index] - m_startCounters[index];
+    }
+#endif
+#if PROFILER_HISTOGRAMS
+    ++anchor.histogram[GetProfileHistogramBucket(elapsed)];
+    if (anchor.tscElapsedMax < elapsed) {
+      anchor.tscElapsedMax = elapsed;
+    }
+    if (m_thread->sampleCount < m_thread->samples.size()) {
+      m_thread->samples[m_thread->sampleCount] = {elapsed, m_anchorIndex};
+    }
+    ++m_thread->sampleCount;
+#endif
+  }
+
+  profile_block(profile_block const &) = delete;
+  profile_block &operator=(profile_block const &) = delete;
 };
 
-void BeginProfile();
+#define ProfilerNameConcat2(A, B) A##B
+#define ProfilerNameConcat(A, B) ProfilerNameConcat2(A, B)
+// NOTE: ByteCount is the amount of data the block processes; the report turns
+// it into throughput so stages can be compared against memory bandwidth.
+#define TimeBandwidth(Name, ByteCount)                                         \
+  static constinit profile_anchor_site ProfilerNameConcat(Site, __LINE__)      \
+      ProfileAnchorSiteAttributes{Name};                                       \
+  profile_block ProfilerNameConcat(Block, __LINE__) {                          \
+    ProfilerNameConcat(Site, __LINE__), ByteCount                              \
+  }
+
+#else
 
-#define TimeBlock(Name)                                                        \
-  profile_point { Name }
+#define TimeBandwidth(...)
+
+#endif
+
+#define TimeBlock(Name) TimeBandwidth(Name, 0)
 #define TimeFunction TimeBlock(__func__)
 
-void print(std::string_view desc, u64 elapsed, u64 begin, u64 end);
+void BeginProfile();
+// Prints the anchors of every thread that recorded any, then their sum when
+// there is more than one. Worker threads must have finished (been joined)
+// before this is called.
 void EndAndPrintProfile();
+// Dumps the trace ring buffers of every thread to path, for
+// profile_trace_to_json. Same threading rule as EndAndPrintProfile. Throws
+// when the build has no trace support or the file can't be written.
+void WriteProfileTrace(char const *path);
+// Keeps the duration of up to samplesPerThread hits on every thread, so
+// percentiles are exact instead of read off the histograms. Call before any
+// block runs. Throws when the build has no histogram support.
+void SetProfileSampleCapacity(u64 samplesPerThread);
+enum class profile_report_format : u32 { Csv, Json };
+
+// Adds key=value to the run metadata of every later report, next to the CPU
+// model and timer frequency the profiler fills in itself; a key set twice
+// keeps the last value. Numbers stay numbers in JSON. Call from the main
+// thread.
+void SetProfileMetadata(std::string_view key, std::string_view value);
+void SetProfileMetadata(std::string_view key, u64 value);
+
+// Writes the merged anchors and the run metadata to path: label, hits,
+// exclusive and inclusive cycles, bytes, throughput and (with
+// PROFILER_HISTOGRAMS) the p50/p90/p99/max cycles per hit. CSV is what
+// profile_compare reads; the layouts are described in profile_report.hpp.
+// Same threading rule as EndAndPrintProfile.
+void WriteProfileReport(char const *path,
+                        profile_report_format format =
+                            profile_report_format::Csv);
+// Samples every thread of the process frequency times per second of CPU
+// time with a SIGPROF timer, keeping up to capacity samples.
+// EndAndPrintProfile stops it and prints where the samples landed, by
+// function and by open block. Works with PROFILER=0 too, minus the blocks.
+// Linux only; throws elsewhere or if the timer can't be set up.
+void StartProfileSampling(u32 frequency, u64 capacity = 1 << 18);
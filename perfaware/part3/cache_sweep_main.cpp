@@ -0,0 +1,127 @@
+/* ========================================================================
+   Cache sweep: runs a read kernel over region sizes from 1k to 1gb, for a
+   few strides, prints the series as CSV, and then the cache levels it
+   found in it. Listings 153 and 158 do the same by hand.
+   
+   Usage: cache_sweep_main [max size in mb] [sizes per doubling]
+   ======================================================================== */
+
+/* NOTE(casey): _CRT_SECURE_NO_WARNINGS is here because otherwise we cannot
+   call fopen(). If we replace fopen() with fopen_s() to avoid the warning,
+   then the code doesn't compile on Linux anymore, since fopen_s() does not
+   exist there.
+   
+   What exactly the CRT maintainers were thinking when they made this choice,
+   I have no idea. */
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <math.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int32_t b32;
+
+typedef float f32;
+typedef double f64;
+
+#define ArrayCount(Array) (sizeof(Array)/sizeof((Array)[0]))
+
+#include "listing_0125_buffer.cpp"
+#include "listing_0169_os_platform.cpp"
+#include "listing_0169a_os_topology.cpp"
+#include "listing_0164_csv_repetition_tester.cpp"
+#include "listing_0164b_test_baseline.cpp"
+#include "listing_0164c_cache_sweep.cpp"
+
+static u64 volatile GlobalSweepSink;
+
+/* NOTE: Reads 64 bytes with two 32-byte loads at every Stride bytes of the region, starting over at
+   the beginning when the next read would run past the end, like ReadStrided_32x2 in listing 157.
+   The loads feed two independent xor chains, so nothing but the loads limits the loop. */
+static void ReadRegion_32x2(u64 ByteCount, u8 *Data, u64 RegionSize, u64 Stride)
+{
+    __m256i SumA = _mm256_setzero_si256();
+    __m256i SumB = _mm256_setzero_si256();
+    
+    u64 ReadsPerPass = 1;
+    if((RegionSize >= 64) && Stride)
+    {
+        ReadsPerPass = (RegionSize - 64) / Stride + 1;
+    }
+    
+    u64 ReadsLeft = ByteCount / 64;
+    while(ReadsLeft)
+    {
+        u64 ReadCount = (ReadsLeft < ReadsPerPass) ? ReadsLeft : ReadsPerPass;
+        ReadsLeft -= ReadCount;
+        
+        u8 *At = Data;
+        for(u64 ReadIndex = 0; ReadIndex < ReadCount; ++ReadIndex)
+        {
+            SumA = _mm256_xor_si256(SumA, _mm256_loadu_si256((__m256i *)At));
+            SumB = _mm256_xor_si256(SumB, _mm256_loadu_si256((__m256i *)(At + 32)));
+            At += Stride;
+        }
+    }
+    
+    __m256i Sum = _mm256_xor_si256(SumA, SumB);
+    GlobalSweepSink = (u64)_mm256_extract_epi64(Sum, 0);
+}
+
+int main(int ArgCount, char **Args)
+{
+    InitializeOSPlatform();
+    
+    int Result = 0;
+    
+    cache_sweep Sweep = {};
+    Sweep.Name = "ReadRegion_32x2";
+    Sweep.Kernel = ReadRegion_32x2;
+    Sweep.MinSize = 1024;
+    Sweep.MaxSize = 1024ull*1024*1024;
+    Sweep.StepsPerDoubling = 2;
+    
+    // NOTE: Whole lines, every other line, and one line per 4k page
+    Sweep.Strides[Sweep.StrideCount++] = 64;
+    Sweep.Strides[Sweep.StrideCount++] = 128;
+    Sweep.Strides[Sweep.StrideCount++] = 4096;
+    
+    if(ArgCount > 1)
+    {
+        Sweep.MaxSize = strtoull(Args[1], 0, 10)*1024*1024;
+    }
+    if(ArgCount > 2)
+    {
+        Sweep.StepsPerDoubling = (u32)strtoul(Args[2], 0, 10);
+    }
+    
+    if(Sweep.MaxSize >= Sweep.MinSize)
+    {
+        cache_sweep_result SweepResult = RunCacheSweep(&Sweep, GetCPUTimerFreq());
+        if(IsValid(SweepResult.Series))
+        {
+            PrintCSVForValue(&SweepResult.Series, StatValue_GBPerSecond, stdout);
+            PrintCacheHierarchy(&SweepResult, stdout);
+            Result = CheckTestSeriesBaseline(&SweepResult.Series);
+        }
+        else
+        {
+            Result = 1;
+        }
+        
+        FreeCacheSweep(&SweepResult);
+    }
+    else
+    {
+        fprintf(stderr, "Usage: %s [max size in mb] [sizes per doubling]\n", Args[0]);
+        Result = 1;
+    }
+    
+    return Result;
+}
@@ -0,0 +1,410 @@
+/* ========================================================================
+   Parallel repetition tester: runs one test function on N pinned threads
+   in lockstep and reports each thread's results and their total. Include
+   after listing_0164_csv_repetition_tester.cpp; it needs the thread calls
+   of listing_0169_os_platform.cpp and listing_0169a_os_topology.cpp.
+   ======================================================================== */
+
+/* NOTE: Parallel mode runs the same test function on ThreadCount threads at once, each pinned to
+   its own CPU. The threads run in lockstep: every repetition starts behind a barrier, so all of
+   them are loading the memory system at the same time, and thread 0 collects the round once
+   everyone has finished it. Each thread keeps its own min/avg/max; the aggregate treats a round
+   as one test whose time is the slowest thread's and whose byte count is everyone's, so its
+   gb/s is the total bandwidth the threads got together. */
+
+#if _WIN32
+inline u32 AtomicIncrement(u32 volatile *Value)
+{
+    u32 Result = (u32)InterlockedIncrement((LONG volatile *)Value);
+    return Result;
+}
+#define CompilerBarrier() _ReadWriteBarrier()
+#else
+inline u32 AtomicIncrement(u32 volatile *Value)
+{
+    u32 Result = __atomic_add_fetch(Value, 1, __ATOMIC_SEQ_CST);
+    return Result;
+}
+#define CompilerBarrier() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#endif
+
+struct spin_barrier
+{
+    u32 volatile ArrivedCount;
+    u32 volatile Generation;
+};
+
+// NOTE: Returns without waiting; the last of the ThreadCount arrivals releases everyone
+static b32 ArriveAtBarrier(spin_barrier *Barrier, u32 ThreadCount)
+{
+    b32 Result = (AtomicIncrement(&Barrier->ArrivedCount) == ThreadCount);
+    if(Result)
+    {
+        Barrier->ArrivedCount = 0;
+        AtomicIncrement(&Barrier->Generation);
+    }
+    return Result;
+}
+
+// NOTE: Spins rather than sleeping, so the threads leave the barrier within a few hundred cycles
+// of each other. That needs a CPU per thread; with more threads than CPUs it still works, slowly.
+static void WaitAtBarrier(spin_barrier *Barrier, u32 ThreadCount)
+{
+    u32 Generation = Barrier->Generation;
+    CompilerBarrier();
+    if(!ArriveAtBarrier(Barrier, ThreadCount))
+    {
+        while(Barrier->Generation == Generation)
+        {
+            _mm_pause();
+        }
+        CompilerBarrier();
+    }
+}
+
+/* NOTE: Which CPU each thread gets. Spread puts consecutive threads on different NUMA nodes, then on
+   different cores, and only uses SMT siblings once every core has a thread, so N threads see as
+   much of the machine as N threads can. Compact fills one node's cores before moving to the next,
+   which keeps the threads close to memory allocated on that node. OSOrder is the order the OS
+   numbers its CPUs in, which on most machines puts siblings either adjacent or half the CPU count
+   apart. */
+enum thread_placement : u32
+{
+    Placement_Spread,
+    Placement_Compact,
+    Placement_OSOrder,
+};
+
+static u64 GetPlacementKey(os_topology *Topology, thread_placement Placement, u32 CPUIndex)
+{
+    os_cpu_info *CPU = Topology->CPUs + CPUIndex;
+    
+    // NOTE: The core's position among the cores of its node, counting each core by its first sibling
+    u64 CoreRank = 0;
+    for(u32 OtherIndex = 0; OtherIndex < Topology->CPUCount; ++OtherIndex)
+    {
+        os_cpu_info *Other = Topology->CPUs + OtherIndex;
+        if((Other->NodeIndex == CPU->NodeIndex) && (Other->SMTIndex == 0) && (Other->CoreIndex < CPU->CoreIndex))
+        {
+            ++CoreRank;
+        }
+    }
+    
+    u64 Result = CPUIndex;
+    if(Placement == Placement_Spread)
+    {
+        Result = ((u64)CPU->SMTIndex << 42) | (CoreRank << 21) | CPU->NodeIndex;
+    }
+    else if(Placement == Placement_Compact)
+    {
+        Result = ((u64)CPU->NodeIndex << 42) | ((u64)CPU->SMTIndex << 21) | CoreRank;
+    }
+    return Result;
+}
+
+// NOTE: Order gets Topology->CPUCount CPU indices, the Nth being the CPU for thread N
+static void FillPlacementOrder(os_topology *Topology, thread_placement Placement, u32 *Order)
+{
+    u64 Keys[MAX_TOPOLOGY_CPUS];
+    for(u32 CPUIndex = 0; CPUIndex < Topology->CPUCount; ++CPUIndex)
+    {
+        u64 Key = GetPlacementKey(Topology, Placement, CPUIndex);
+        
+        u32 Dest = CPUIndex;
+        for(; (Dest > 0) && (Keys[Dest - 1] > Key); --Dest)
+        {
+            Keys[Dest] = Keys[Dest - 1];
+            Order[Dest] = Order[Dest - 1];
+        }
+        Keys[Dest] = Key;
+        Order[Dest] = CPUIndex;
+    }
+}
+
+// NOTE: For finding a thread's node ahead of a wave, to give it a buffer from AllocateBufferOnNode:
+// GetOSTopology()->CPUs[GetPlacementCPUIndex(Placement, ThreadIndex)].NodeIndex
+inline u32 GetPlacementCPUIndex(thread_placement Placement, u32 ThreadIndex)
+{
+    os_topology *Topology = GetOSTopology();
+    u32 Order[MAX_TOPOLOGY_CPUS];
+    FillPlacementOrder(Topology, Placement, Order);
+    
+    u32 Result = Order[ThreadIndex % Topology->CPUCount];
+    return Result;
+}
+
+// NOTE: Runs one repetition on one thread, bracketing the measured work with BeginTime/EndTime
+// and counting its bytes, just like the body of a single threaded IsTesting loop.
+typedef void parallel_test_function(repetition_tester *Tester, u32 ThreadIndex, void *Data);
+
+struct parallel_repetition_tester;
+struct parallel_test_thread
+{
+    repetition_tester Tester;
+    parallel_repetition_tester *Parallel;
+    thread_handle Handle;
+    u32 ThreadIndex;
+    u32 CPUIndex; // NOTE: Index into the topology's CPUs, as PinCurrentThreadToCPU takes it
+    b32 Pinned;
+};
+
+struct parallel_repetition_tester
+{
+    repetition_tester Aggregate;
+    thread_placement Placement;
+    
+    u32 ThreadCount;
+    buffer ThreadMemory;
+    parallel_test_thread *Threads; // NOTE: [ThreadCount]
+    
+    parallel_test_function *Function;
+    void *Data;
+    spin_barrier Barrier;
+    b32 volatile Done;
+};
+
+/* NOTE: The OS counts page faults for the whole process (and Windows has no per-thread count), so
+   each thread's own count would include the others'. The threads' counts are dropped, and the round
+   gets the process's faults from the first barrier to the second, which bracket all of its work. */
+static void CollectParallelRound(parallel_repetition_tester *Parallel, u64 PageFaultCount)
+{
+    repetition_value Round = {};
+    b32 AnyRan = false;
+    for(u32 ThreadIndex = 0; ThreadIndex < Parallel->ThreadCount; ++ThreadIndex)
+    {
+        repetition_tester *Tester = &Parallel->Threads[ThreadIndex].Tester;
+        Tester->AccumulatedOnThisTest.E[RepValue_MemPageFaults] = 0;
+        repetition_value Accum = Tester->AccumulatedOnThisTest;
+        b32 Ran = (Tester->OpenBlockCount != 0);
+        
+        IsTesting(Tester);
+        if(Tester->Mode == TestMode_Error)
+        {
+            Error(&Parallel->Aggregate, "Test thread failed");
+        }
+        
+        if(Ran)
+        {
+            AnyRan = true;
+            if(Round.E[RepValue_CPUTimer] < Accum.E[RepValue_CPUTimer])
+            {
+                Round.E[RepValue_CPUTimer] = Accum.E[RepValue_CPUTimer];
+            }
+            
+            Round.E[RepValue_ByteCount] += Accum.E[RepValue_ByteCount];
+            for(u32 Index = 0; Index < PERF_COUNTER_COUNT; ++Index)
+            {
+                Round.E[RepValue_Instructions + Index] += Accum.E[RepValue_Instructions + Index];
+            }
+        }
+    }
+    
+    if(AnyRan)
+    {
+        Round.E[RepValue_MemPageFaults] = PageFaultCount;
+    }
+    
+    repetition_tester *Aggregate = &Parallel->Aggregate;
+    Aggregate->AccumulatedOnThisTest = Round;
+    Aggregate->OpenBlockCount = Aggregate->CloseBlockCount = AnyRan;
+    if(!IsTesting(Aggregate))
+    {
+        Parallel->Done = true;
+    }
+}
+
+THREAD_ENTRY_POINT(ParallelTestThread, Parameter)
+{
+    parallel_test_thread *Thread = (parallel_test_thread *)Parameter;
+    parallel_repetition_tester *Parallel = Thread->Parallel;
+    
+    Thread->Pinned = PinCurrentThreadToCPU(Thread->CPUIndex);
+    InitializePerfCounters();
+    
+    u64 PageFaultsAtStart = 0;
+    for(;;)
+    {
+        // NOTE: Thread 0 reads the count while the other threads wait at the barrier or have just left the last one
+        if(Thread->ThreadIndex == 0)
+        {
+            PageFaultsAtStart = ReadOSPageFaultCount();
+        }
+        
+        WaitAtBarrier(&Parallel->Barrier, Parallel->ThreadCount);
+        if(Parallel->Done)
+        {
+            break;
+        }
+        
+        Parallel->Function(&Thread->Tester, Thread->ThreadIndex, Parallel->Data);
+        
+        WaitAtBarrier(&Parallel->Barrier, Parallel->ThreadCount);
+        if(Thread->ThreadIndex == 0)
+        {
+            CollectParallelRound(Parallel, ReadOSPageFaultCount() - PageFaultsAtStart);
+        }
+    }
+    
+    ClosePerfCounters();
+    return 0;
+}
+
+static void PrintParallelResults(parallel_repetition_tester *Parallel)
+{
+    for(u32 ThreadIndex = 0; ThreadIndex < Parallel->ThreadCount; ++ThreadIndex)
+    {
+        parallel_test_thread *Thread = Parallel->Threads + ThreadIndex;
+        os_cpu_info *CPU = GetOSTopology()->CPUs + Thread->CPUIndex;
+        repetition_test_results *Results = &Thread->Tester.Results;
+        u64 CPUTimerFreq = Thread->Tester.CPUTimerFreq;
+        ComputeDerivedValues(&Results->Total, CPUTimerFreq);
+        ComputeDerivedValues(&Results->Min, CPUTimerFreq);
+        ComputeDerivedValues(&Results->Max, CPUTimerFreq);
+        
+        printf("Thread %u (CPU %u, node %u%s): min %fms %fgb/s, avg %fms %fgb/s, max %fms %fgb/s\n",
+               ThreadIndex, CPU->OSIndex, CPU->NodeIndex, Thread->Pinned ? "" : ", not pinned",
+               1000.0*Results->Min.PerCount[StatValue_Seconds], Results->Min.PerCount[StatValue_GBPerSecond],
+               1000.0*Results->Total.PerCount[StatValue_Seconds], Results->Total.PerCount[StatValue_GBPerSecond],
+               1000.0*Results->Max.PerCount[StatValue_Seconds], Results->Max.PerCount[StatValue_GBPerSecond]);
+    }
+    
+    printf("All %u threads:\n", Parallel->ThreadCount);
+    PrintResults(Parallel->Aggregate.Results);
+}
+
+/* NOTE: TargetProcessedByteCount is per thread. Like the single threaded tester, a parallel tester
+   can run several waves to keep refining its minimums, but always with the same ThreadCount.
+   Thread N runs on the Nth CPU in Parallel->Placement's order, wrapping around when there are more
+   threads than CPUs. */
+inline void RunParallelTestWave(parallel_repetition_tester *Parallel, u32 ThreadCount,
+                                parallel_test_function *Function, void *Data,
+                                u64 TargetProcessedByteCount, u64 CPUTimerFreq, u32 SecondsToTry = 10)
+{
+    repetition_tester *Aggregate = &Parallel->Aggregate;
+    NewTestWave(Aggregate, ThreadCount*TargetProcessedByteCount, CPUTimerFreq, SecondsToTry);
+    Aggregate->Quiet = true;
+    
+    if(!Parallel->Threads)
+    {
+        Parallel->ThreadMemory = AllocateBuffer(ThreadCount*sizeof(parallel_test_thread));
+        if(IsValid(Parallel->ThreadMemory))
+        {
+            Parallel->ThreadCount = ThreadCount;
+            Parallel->Threads = (parallel_test_thread *)Parallel->ThreadMemory.Data;
+        }
+    }
+    
+    if(!Parallel->Threads)
+    {
+        Error(Aggregate, "Unable to allocate test threads");
+    }
+    else if(Parallel->ThreadCount != ThreadCount)
+    {
+        Error(Aggregate, "ThreadCount changed");
+    }
+    
+    if(Aggregate->Mode == TestMode_Testing)
+    {
+        Parallel->Function = Function;
+        Parallel->Data = Data;
+        Parallel->Done = false;
+        
+        os_topology *Topology = GetOSTopology();
+        u32 CPUCount = Topology->CPUCount;
+        u32 Order[MAX_TOPOLOGY_CPUS];
+        FillPlacementOrder(Topology, Parallel->Placement, Order);
+        if(ThreadCount > CPUCount)
+        {
+            fprintf(stderr, "WARNING: %u threads on %u CPUs - the threads take turns, so the total gb/s is overstated\n",
+                    ThreadCount, CPUCount);
+        }
+        for(u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
+        {
+            parallel_test_thread *Thread = Parallel->Threads + ThreadIndex;
+            Thread->Parallel = Parallel;
+            Thread->ThreadIndex = ThreadIndex;
+            Thread->CPUIndex = Order[ThreadIndex % CPUCount];
+            
+            // NOTE: The aggregate decides when the wave is over, so the threads' own testers never time out or converge
+            NewTestWave(&Thread->Tester, TargetProcessedByteCount, CPUTimerFreq, SecondsToTry);
+            Thread->Tester.TryForTime = (u64)-1;
+            Thread->Tester.ConvergenceTolerance = 0;
+            Thread->Tester.PrintNewMinimums = false;
+            Thread->Tester.Quiet = true;
+        }
+        
+        u32 StartedCount = 0;
+        for(; StartedCount < ThreadCount; ++StartedCount)
+        {
+            parallel_test_thread *Thread = Parallel->Threads + StartedCount;
+            Thread->Handle = CreateAndStartThread(ParallelTestThread, Thread);
+            if(!IsValidThread(Thread->Handle))
+            {
+                break;
+            }
+        }
+        
+        if(StartedCount < ThreadCount)
+        {
+            // NOTE: The threads that did start are waiting at the first barrier, so arrive for the rest
+            Error(Aggregate, "Unable to start test threads");
+            Parallel->Done = true;
+            for(u32 Missing = StartedCount; Missing < ThreadCount; ++Missing)
+            {
+                ArriveAtBarrier(&Parallel->Barrier, ThreadCount);
+            }
+        }
+        
+        for(u32 ThreadIndex = 0; ThreadIndex < StartedCount; ++ThreadIndex)
+        {
+            JoinThread(Parallel->Threads[ThreadIndex].Handle);
+        }
+        
+        if(Aggregate->Mode == TestMode_Completed)
+        {
+            printf("                                                          \r");
+            PrintParallelResults(Parallel);
+        }
+    }
+}
+
+inline void FreeParallelTester(parallel_repetition_tester *Parallel)
+{
+    if(Parallel)
+    {
+        for(u32 ThreadIndex = 0; ThreadIndex < Parallel->ThreadCount; ++ThreadIndex)
+        {
+            FreeTestSamples(&Parallel->Threads[ThreadIndex].Tester);
+        }
+        FreeTestSamples(&Parallel->Aggregate);
+        FreeBuffer(&Parallel->ThreadMemory);
+        *Parallel = {};
+    }
+}
+
+// NOTE: Stores the aggregate results in the current cell, so a series with one row per thread
+// count prints total gb/s against thread count.
+inline void RunParallelTestWave(repetition_test_series *Series, parallel_repetition_tester *Parallel,
+                                u32 ThreadCount, parallel_test_function *Function, void *Data,
+                                u64 TargetProcessedByteCount, u64 CPUTimerFreq, u32 SecondsToTry = 10)
+{
+    if(IsInBounds(Series))
+    {
+        printf("\n--- %s %s ---\n",
+               Series->ColumnLabels[Series->ColumnIndex].Chars,
+               Series->RowLabels[Series->RowIndex].Chars);
+    }
+    
+    RunParallelTestWave(Parallel, ThreadCount, Function, Data, TargetProcessedByteCount, CPUTimerFreq, SecondsToTry);
+    
+    if(IsInBounds(Series))
+    {
+        *GetTestResults(Series, Series->ColumnIndex, Series->RowIndex) = Parallel->Aggregate.Results;
+        
+        if(++Series->ColumnIndex >= Series->ColumnCount)
+        {
+            Series->ColumnIndex = 0;
+            ++Series->RowIndex;
+        }
+    }
+}
@@ -0,0 +1,262 @@
+/* ========================================================================
+   Test baselines: saves a series' results to a file and compares a later
+   run against them, flagging the cells that got significantly slower.
+   Include after listing_0164_csv_repetition_tester.cpp.
+   ======================================================================== */
+
+/* NOTE: A baseline is a binary snapshot of a series: the min time of every cell that ran, with the
+   95% interval for it and the median. Cells are matched up by their row and column labels, so an
+   old baseline still applies after tests are added, removed or reordered. Times are stored in
+   seconds, so baselines compare across machines with different CPU timer frequencies. */
+#define REPETITION_BASELINE_MAGIC 0x4c534142 // NOTE: "BASL"
+#define REPETITION_BASELINE_VERSION 1
+
+struct repetition_baseline_header
+{
+    u32 Magic;
+    u32 Version;
+    u32 CellCount;
+    u32 Reserved;
+};
+
+struct repetition_baseline_cell
+{
+    repetition_series_label RowLabel;
+    repetition_series_label ColumnLabel;
+    u64 ByteCount;
+    u64 SampleCount;
+    f64 MinSeconds;
+    f64 MinCIHighSeconds;
+    f64 MedianSeconds;
+    f64 MADSeconds;
+};
+
+static b32 HasRun(repetition_test_results *Results)
+{
+    b32 Result = (Results->Total.E[RepValue_TestCount] != 0);
+    return Result;
+}
+
+static repetition_baseline_cell GetBaselineCell(repetition_test_series *Series, u32 ColumnIndex, u32 RowIndex)
+{
+    repetition_test_results *Results = GetTestResults(Series, ColumnIndex, RowIndex);
+    
+    repetition_baseline_cell Cell = {};
+    Cell.RowLabel = Series->RowLabels[RowIndex];
+    Cell.ColumnLabel = Series->ColumnLabels[ColumnIndex];
+    Cell.ByteCount = Results->Min.E[RepValue_ByteCount];
+    Cell.SampleCount = Results->SampleCount;
+    Cell.MinSeconds = Results->Min.PerCount[StatValue_Seconds];
+    Cell.MinCIHighSeconds = Results->SampleCount ? Results->MinCIHigh.PerCount[StatValue_Seconds] : Cell.MinSeconds;
+    Cell.MedianSeconds = Results->Median.PerCount[StatValue_Seconds];
+    Cell.MADSeconds = Results->MAD.PerCount[StatValue_Seconds];
+    
+    return Cell;
+}
+
+static b32 WriteTestSeriesBaseline(repetition_test_series *Series, char const *FileName)
+{
+    b32 Result = false;
+    
+    FILE *File = fopen(FileName, "wb");
+    if(File)
+    {
+        repetition_baseline_header Header = {};
+        Header.Magic = REPETITION_BASELINE_MAGIC;
+        Header.Version = REPETITION_BASELINE_VERSION;
+        for(u32 RowIndex = 0; RowIndex < Series->MaxRowCount; ++RowIndex)
+        {
+            for(u32 ColumnIndex = 0; ColumnIndex < Series->ColumnCount; ++ColumnIndex)
+            {
+                Header.CellCount += HasRun(GetTestResults(Series, ColumnIndex, RowIndex));
+            }
+        }
+        
+        Result = (fwrite(&Header, sizeof(Header), 1, File) == 1);
+        for(u32 RowIndex = 0; RowIndex < Series->MaxRowCount; ++RowIndex)
+        {
+            for(u32 ColumnIndex = 0; ColumnIndex < Series->ColumnCount; ++ColumnIndex)
+            {
+                if(HasRun(GetTestResults(Series, ColumnIndex, RowIndex)))
+                {
+                    repetition_baseline_cell Cell = GetBaselineCell(Series, ColumnIndex, RowIndex);
+                    Result &= (fwrite(&Cell, sizeof(Cell), 1, File) == 1);
+                }
+            }
+        }
+        
+        Result &= (fclose(File) == 0);
+    }
+    
+    if(!Result)
+    {
+        fprintf(stderr, "ERROR: Unable to write baseline \"%s\".\n", FileName);
+    }
+    
+    return Result;
+}
+
+static b32 LabelsMatch(repetition_series_label *A, repetition_series_label *B)
+{
+    b32 Result = true;
+    for(u32 Index = 0; Index < ArrayCount(A->Chars); ++Index)
+    {
+        if(A->Chars[Index] != B->Chars[Index])
+        {
+            Result = false;
+            break;
+        }
+        
+        if(!A->Chars[Index])
+        {
+            break;
+        }
+    }
+    
+    return Result;
+}
+
+/* NOTE: A cell counts as significantly slower (or faster) only when its 95% interval for the min
+   doesn't overlap the baseline's, and the mins differ by more than the larger of the two MADs.
+   The intervals alone get very tight on a quiet machine, and would flag shifts of a few cycles
+   that are smaller than the ordinary jitter between tests. A significant slowdown of more than ThresholdPercent is a
+   regression. Returns false if the baseline couldn't be read. */
+static b32 CompareTestSeriesToBaseline(repetition_test_series *Series, char *FileName, f64 ThresholdPercent,
+                                       u32 *RegressionCount)
+{
+    b32 Result = false;
+    *RegressionCount = 0;
+    
+    buffer Baseline = ReadEntireFile(FileName);
+    repetition_baseline_header *Header = (repetition_baseline_header *)Baseline.Data;
+    repetition_baseline_cell *BaseCells = (repetition_baseline_cell *)(Header + 1);
+    b32 IsBaseline = (IsValid(Baseline) &&
+                      (Baseline.Count >= sizeof(*Header)) &&
+                      (Header->Magic == REPETITION_BASELINE_MAGIC) &&
+                      (Header->Version == REPETITION_BASELINE_VERSION) &&
+                      (((Baseline.Count - sizeof(*Header)) / sizeof(repetition_baseline_cell)) >= Header->CellCount));
+    if(IsValid(Baseline) && !IsBaseline)
+    {
+        fprintf(stderr, "ERROR: \"%s\" is not a repetition tester baseline.\n", FileName);
+    }
+    
+    if(IsBaseline)
+    {
+        Result = true;
+        
+        printf("\n--- Compared to %s (regression threshold %.2f%%) ---\n", FileName, ThresholdPercent);
+        u32 ComparedCount = 0;
+        for(u32 RowIndex = 0; RowIndex < Series->MaxRowCount; ++RowIndex)
+        {
+            for(u32 ColumnIndex = 0; ColumnIndex < Series->ColumnCount; ++ColumnIndex)
+            {
+                if(HasRun(GetTestResults(Series, ColumnIndex, RowIndex)))
+                {
+                    repetition_baseline_cell New = GetBaselineCell(Series, ColumnIndex, RowIndex);
+                    printf("%s %s: ", New.ColumnLabel.Chars, New.RowLabel.Chars);
+                    
+                    repetition_baseline_cell *Base = 0;
+                    for(u32 CellIndex = 0; CellIndex < Header->CellCount; ++CellIndex)
+                    {
+                        if(LabelsMatch(&BaseCells[CellIndex].RowLabel, &New.RowLabel) &&
+                           LabelsMatch(&BaseCells[CellIndex].ColumnLabel, &New.ColumnLabel))
+                        {
+                            Base = BaseCells + CellIndex;
+                            break;
+                        }
+                    }
+                    
+                    if(!Base)
+                    {
+                        printf("not in baseline\n");
+                    }
+                    else if(Base->ByteCount != New.ByteCount)
+                    {
+                        printf("byte count changed from %llu to %llu, not compared\n",
+                               (unsigned long long)Base->ByteCount, (unsigned long long)New.ByteCount);
+                    }
+                    else if((Base->MinSeconds > 0) && (New.MinSeconds > 0))
+                    {
+                        ++ComparedCount;
+                        
+                        f64 Speedup = Base->MinSeconds / New.MinSeconds;
+                        f64 ChangePercent = 100.0*(New.MinSeconds / Base->MinSeconds - 1.0);
+                        f64 Jitter = (Base->MADSeconds > New.MADSeconds) ? Base->MADSeconds : New.MADSeconds;
+                        char const *Flag = "";
+                        if((New.MinSeconds > Base->MinCIHighSeconds) && ((New.MinSeconds - Base->MinSeconds) > Jitter))
+                        {
+                            if(ChangePercent > ThresholdPercent)
+                            {
+                                Flag = "  REGRESSION";
+                                ++*RegressionCount;
+                            }
+                            else
+                            {
+                                Flag = "  slower";
+                            }
+                        }
+                        else if((New.MinCIHighSeconds < Base->MinSeconds) && ((Base->MinSeconds - New.MinSeconds) > Jitter))
+                        {
+                            Flag = "  faster";
+                        }
+                        
+                        printf("%fms -> %fms, %.3fx (%+.2f%%)%s\n",
+                               1000.0*Base->MinSeconds, 1000.0*New.MinSeconds, Speedup, ChangePercent, Flag);
+                    }
+                    else
+                    {
+                        printf("no time to compare\n");
+                    }
+                }
+            }
+        }
+        
+        printf("%u of %u cells regressed by more than %.2f%%\n", *RegressionCount, ComparedCount, ThresholdPercent);
+    }
+    
+    FreeBuffer(&Baseline);
+    
+    return Result;
+}
+
+/* NOTE: Lets any benchmark that prints a series double as a regression gate without changing its
+   arguments. REPETITION_BASELINE_SAVE=file writes a baseline of this run, REPETITION_BASELINE=file
+   compares this run against one, and REPETITION_BASELINE_THRESHOLD sets the percentage a
+   significant slowdown has to exceed to fail (default 5). Returns the exit code for main: 2 when
+   a cell regressed, 1 when a baseline couldn't be read or written, and 0 otherwise. */
+inline int CheckTestSeriesBaseline(repetition_test_series *Series)
+{
+    int Result = 0;
+    
+    char *ComparePath = getenv("REPETITION_BASELINE");
+    if(ComparePath && *ComparePath)
+    {
+        f64 ThresholdPercent = 5.0;
+        char *Threshold = getenv("REPETITION_BASELINE_THRESHOLD");
+        if(Threshold && *Threshold)
+        {
+            ThresholdPercent = atof(Threshold);
+        }
+        
+        u32 RegressionCount = 0;
+        if(!CompareTestSeriesToBaseline(Series, ComparePath, ThresholdPercent, &RegressionCount))
+        {
+            Result = 1;
+        }
+        else if(RegressionCount)
+        {
+            Result = 2;
+        }
+    }
+    
+    char *SavePath = getenv("REPETITION_BASELINE_SAVE");
+    if(SavePath && *SavePath)
+    {
+        if(!WriteTestSeriesBaseline(Series, SavePath) && !Result)
+        {
+            Result = 1;
+        }
+    }
+    
+    return Result;
+}
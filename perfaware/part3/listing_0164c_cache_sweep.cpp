@@ -0,0 +1,333 @@
+/* ========================================================================
+   Cache sweep: times one read kernel over log spaced region sizes and
+   strides, and finds the bandwidth plateaus that mark each cache level.
+   Include after listing_0164_csv_repetition_tester.cpp; it needs the
+   topology calls of listing_0169a_os_topology.cpp.
+   ======================================================================== */
+
+/* NOTE: A cache sweep runs one read kernel over a range of region sizes, log spaced from MinSize to
+   MaxSize, for each of a set of strides. Each size is a row of the series and each stride a column.
+   Every test reads at least MinBytesPerTest bytes, going over small regions many times, so the
+   small sizes measure the cache and not the call overhead. Fields left at 0 get the defaults
+   below. Kernels that mask their offset instead of wrapping need power of two sizes, which is
+   what StepsPerDoubling = 1 gives. */
+typedef void cache_sweep_kernel(u64 ByteCount, u8 *Data, u64 RegionSize, u64 Stride);
+
+#define MAX_CACHE_SWEEP_STRIDES 16
+#define MAX_CACHE_PLATEAUS 8
+
+struct cache_sweep
+{
+    char const *Name;
+    cache_sweep_kernel *Kernel;
+    
+    u64 MinSize; // NOTE: Default 1k
+    u64 MaxSize; // NOTE: Default 1gb
+    u32 StepsPerDoubling; // NOTE: Default 1
+    u64 SizeAlignment; // NOTE: Sizes are rounded down to a multiple of this; default 256
+    
+    u32 StrideCount;
+    u64 Strides[MAX_CACHE_SWEEP_STRIDES]; // NOTE: Default one stride of 64
+    
+    u64 MinBytesPerTest; // NOTE: Default 64mb
+    u32 SecondsToTry; // NOTE: Default 3
+    f64 ConvergenceTolerance; // NOTE: Default 0.01
+};
+
+struct cache_sweep_result
+{
+    repetition_test_series Series;
+    
+    buffer SizeMemory;
+    u32 SizeCount;
+    u64 *Sizes; // NOTE: [SizeCount], the region size of each row
+};
+
+struct cache_plateau
+{
+    u32 FirstRow;
+    u32 LastRow;
+    f64 GBPerSecond; // NOTE: Median over the plateau's rows
+};
+
+static u32 GetCacheSweepSizes(cache_sweep *Sweep, u64 *Sizes, u32 MaxSizeCount)
+{
+    u32 Result = 0;
+    f64 Step = pow(2.0, 1.0 / (f64)Sweep->StepsPerDoubling);
+    f64 Size = (f64)Sweep->MinSize;
+    for(u32 StepIndex = 0; (Size <= (f64)Sweep->MaxSize*1.0001) && (Result < MaxSizeCount); ++StepIndex)
+    {
+        u64 Aligned = ((u64)(Size + 0.5) / Sweep->SizeAlignment)*Sweep->SizeAlignment;
+        if(Aligned > Sweep->MaxSize)
+        {
+            Aligned = (Sweep->MaxSize / Sweep->SizeAlignment)*Sweep->SizeAlignment;
+        }
+        
+        if(Aligned && (!Result || (Sizes[Result - 1] != Aligned)))
+        {
+            Sizes[Result++] = Aligned;
+        }
+        
+        Size = (f64)Sweep->MinSize*pow(Step, (f64)(StepIndex + 1));
+    }
+    
+    return Result;
+}
+
+inline cache_sweep_result RunCacheSweep(cache_sweep *Sweep, u64 CPUTimerFreq)
+{
+    cache_sweep_result Result = {};
+    
+    if(!Sweep->MinSize) Sweep->MinSize = 1024;
+    if(!Sweep->MaxSize) Sweep->MaxSize = 1024*1024*1024;
+    if(!Sweep->StepsPerDoubling) Sweep->StepsPerDoubling = 1;
+    if(!Sweep->SizeAlignment) Sweep->SizeAlignment = 256;
+    if(!Sweep->StrideCount) Sweep->Strides[Sweep->StrideCount++] = 64;
+    if(!Sweep->MinBytesPerTest) Sweep->MinBytesPerTest = 64*1024*1024;
+    if(!Sweep->SecondsToTry) Sweep->SecondsToTry = 3;
+    if(Sweep->ConvergenceTolerance == 0) Sweep->ConvergenceTolerance = 0.01;
+    if(Sweep->StrideCount > MAX_CACHE_SWEEP_STRIDES) Sweep->StrideCount = MAX_CACHE_SWEEP_STRIDES;
+    
+    // NOTE: 64 sizes per doubling over 64 doublings is far more than any sweep needs
+    u32 MaxSizeCount = 64*64;
+    Result.SizeMemory = AllocateBuffer(MaxSizeCount*sizeof(u64));
+    Result.Sizes = (u64 *)Result.SizeMemory.Data;
+    if(Result.Sizes)
+    {
+        Result.SizeCount = GetCacheSweepSizes(Sweep, Result.Sizes, MaxSizeCount);
+    }
+    
+    buffer Buffer = {};
+    if(Result.SizeCount)
+    {
+        Result.Series = AllocateTestSeries(Sweep->StrideCount, Result.SizeCount);
+        Buffer = AllocateBuffer(Result.Sizes[Result.SizeCount - 1]);
+    }
+    
+    if(IsValid(Result.Series) && IsValid(Buffer))
+    {
+        // NOTE(casey): Because OSes may not map allocated pages until they are written to, we write garbage
+        // to the entire buffer to force it to be mapped.
+        for(u64 ByteIndex = 0; ByteIndex < Buffer.Count; ++ByteIndex)
+        {
+            Buffer.Data[ByteIndex] = (u8)ByteIndex;
+        }
+        
+        repetition_test_series *Series = &Result.Series;
+        SetRowLabelLabel(Series, "Size");
+        for(u32 SizeIndex = 0; SizeIndex < Result.SizeCount; ++SizeIndex)
+        {
+            u64 Size = Result.Sizes[SizeIndex];
+            u64 TestBytes = (Size > Sweep->MinBytesPerTest) ? Size : Sweep->MinBytesPerTest;
+            TestBytes = (TestBytes / Sweep->SizeAlignment)*Sweep->SizeAlignment;
+            
+            SetRowLabel(Series, "%llu", (unsigned long long)Size);
+            for(u32 StrideIndex = 0; StrideIndex < Sweep->StrideCount; ++StrideIndex)
+            {
+                u64 Stride = Sweep->Strides[StrideIndex];
+                SetColumnLabel(Series, "%s stride %llu", Sweep->Name, (unsigned long long)Stride);
+                
+                repetition_tester Tester = {};
+                Tester.ConvergenceTolerance = Sweep->ConvergenceTolerance;
+                NewTestWave(Series, &Tester, TestBytes, CPUTimerFreq, Sweep->SecondsToTry);
+                
+                while(IsTesting(Series, &Tester))
+                {
+                    BeginTime(&Tester);
+                    Sweep->Kernel(TestBytes, Buffer.Data, Size, Stride);
+                    EndTime(&Tester);
+                    CountBytes(&Tester, TestBytes);
+                }
+            }
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to allocate the cache sweep\n");
+    }
+    
+    FreeBuffer(&Buffer);
+    
+    return Result;
+}
+
+inline void FreeCacheSweep(cache_sweep_result *Result)
+{
+    if(Result)
+    {
+        FreeTestSeries(&Result->Series);
+        FreeBuffer(&Result->SizeMemory);
+        *Result = {};
+    }
+}
+
+/* NOTE: Walks the sizes upward, extending the current plateau for as long as the bandwidth stays
+   within DropFraction of the best it has reached, and starting a new one when it falls further
+   than that. A run shorter than MinPoints is the slope between two levels rather than a level of
+   its own, so it is dropped. That leaves one plateau per level of the hierarchy the working set
+   fits in, and the last row of each is the largest size that still fit. */
+static u32 FindCachePlateaus(f64 *GBPerSecond, u32 Count, cache_plateau *Plateaus, u32 MaxPlateauCount)
+{
+    f64 DropFraction = 0.15;
+    u32 MinPoints = 2;
+    
+    u32 Result = 0;
+    u32 First = 0;
+    f64 Best = Count ? GBPerSecond[0] : 0;
+    for(u32 Row = 1; Row <= Count; ++Row)
+    {
+        if((Row == Count) || (GBPerSecond[Row] < Best*(1.0 - DropFraction)))
+        {
+            u32 PointCount = Row - First;
+            if((PointCount >= MinPoints) && (Result < MaxPlateauCount))
+            {
+                // NOTE: Insertion sort for the median; plateaus are a handful of rows long
+                f64 Sorted[64];
+                u32 SortedCount = 0;
+                for(u32 At = First; (At < Row) && (SortedCount < ArrayCount(Sorted)); ++At)
+                {
+                    u32 Dest = SortedCount++;
+                    for(; (Dest > 0) && (Sorted[Dest - 1] > GBPerSecond[At]); --Dest)
+                    {
+                        Sorted[Dest] = Sorted[Dest - 1];
+                    }
+                    Sorted[Dest] = GBPerSecond[At];
+                }
+                
+                cache_plateau *Plateau = Plateaus + Result++;
+                Plateau->FirstRow = First;
+                Plateau->LastRow = Row - 1;
+                Plateau->GBPerSecond = 0.5*(Sorted[(SortedCount - 1) / 2] + Sorted[SortedCount / 2]);
+            }
+            
+            if(Row < Count)
+            {
+                First = Row;
+                Best = GBPerSecond[Row];
+            }
+        }
+        else if(Best < GBPerSecond[Row])
+        {
+            Best = GBPerSecond[Row];
+        }
+    }
+    
+    return Result;
+}
+
+static void FormatByteSize(char *Dest, u32 DestSize, u64 ByteCount)
+{
+    if(ByteCount >= (1024ull*1024*1024))
+    {
+        snprintf(Dest, DestSize, "%.4gg", (f64)ByteCount / (1024.0*1024.0*1024.0));
+    }
+    else if(ByteCount >= (1024*1024))
+    {
+        snprintf(Dest, DestSize, "%.4gm", (f64)ByteCount / (1024.0*1024.0));
+    }
+    else
+    {
+        snprintf(Dest, DestSize, "%.4gk", (f64)ByteCount / 1024.0);
+    }
+}
+
+// NOTE: The data or unified cache the OS reports for a level, or 0
+static u64 GetOSCacheSize(os_topology *Topology, u32 Level)
+{
+    u64 Result = 0;
+    for(u32 CacheIndex = 0; CacheIndex < Topology->CacheCount; ++CacheIndex)
+    {
+        os_cache_info *Cache = Topology->Caches + CacheIndex;
+        if((Cache->Level == Level) && (Cache->Type != Cache_Instruction))
+        {
+            Result = Cache->Size;
+        }
+    }
+    
+    return Result;
+}
+
+/* NOTE: Prints one summary per stride. The plateaus are named L1, L2, ... in order, and the last
+   is named DRAM when the sweep went past twice the largest cache the OS reports, so its working
+   set can't have fit. Next to each cache level is the size the OS reports for it, as a check. */
+inline void PrintCacheHierarchy(cache_sweep_result *Result, FILE *Dest)
+{
+    repetition_test_series *Series = &Result->Series;
+    os_topology *Topology = GetOSTopology();
+    
+    u64 LargestCacheSize = 0;
+    u32 OSLevelCount = 0;
+    for(u32 CacheIndex = 0; CacheIndex < Topology->CacheCount; ++CacheIndex)
+    {
+        os_cache_info *Cache = Topology->Caches + CacheIndex;
+        if(LargestCacheSize < Cache->Size)
+        {
+            LargestCacheSize = Cache->Size;
+        }
+        if(OSLevelCount < Cache->Level)
+        {
+            OSLevelCount = Cache->Level;
+        }
+    }
+    
+    f64 GBPerSecond[64*64];
+    u32 RowCount = (Series->RowIndex < ArrayCount(GBPerSecond)) ? Series->RowIndex : ArrayCount(GBPerSecond);
+    for(u32 ColumnIndex = 0; ColumnIndex < Series->ColumnCount; ++ColumnIndex)
+    {
+        for(u32 Row = 0; Row < RowCount; ++Row)
+        {
+            GBPerSecond[Row] = GetTestResults(Series, ColumnIndex, Row)->Min.PerCount[StatValue_GBPerSecond];
+        }
+        
+        cache_plateau Plateaus[MAX_CACHE_PLATEAUS];
+        u32 PlateauCount = FindCachePlateaus(GBPerSecond, RowCount, Plateaus, ArrayCount(Plateaus));
+        
+        fprintf(Dest, "\n--- Cache hierarchy from %s ---\n", Series->ColumnLabels[ColumnIndex].Chars);
+        b32 ReachedDRAM = false;
+        for(u32 PlateauIndex = 0; PlateauIndex < PlateauCount; ++PlateauIndex)
+        {
+            cache_plateau *Plateau = Plateaus + PlateauIndex;
+            b32 IsLast = ((PlateauIndex + 1) == PlateauCount);
+            b32 IsDRAM = (IsLast && (PlateauIndex > 0) && LargestCacheSize &&
+                          (Result->Sizes[Plateau->LastRow] > 2*LargestCacheSize));
+            
+            char First[32], Last[32];
+            FormatByteSize(First, sizeof(First), Result->Sizes[Plateau->FirstRow]);
+            FormatByteSize(Last, sizeof(Last), Result->Sizes[Plateau->LastRow]);
+            
+            if(IsDRAM)
+            {
+                ReachedDRAM = true;
+                fprintf(Dest, "DRAM: from %s, %fgb/s\n", First, Plateau->GBPerSecond);
+            }
+            else
+            {
+                fprintf(Dest, "L%u: %s to %s, %fgb/s", PlateauIndex + 1, First, Last, Plateau->GBPerSecond);
+                if(!IsLast && ((Plateau->LastRow + 1) < RowCount))
+                {
+                    char Next[32];
+                    FormatByteSize(Next, sizeof(Next), Result->Sizes[Plateau->LastRow + 1]);
+                    fprintf(Dest, " (falls off by %s)", Next);
+                }
+                
+                u64 OSSize = GetOSCacheSize(Topology, PlateauIndex + 1);
+                if(OSSize)
+                {
+                    char OS[32];
+                    FormatByteSize(OS, sizeof(OS), OSSize);
+                    fprintf(Dest, " [OS reports %s]", OS);
+                }
+                fprintf(Dest, "\n");
+            }
+        }
+        
+        if(ReachedDRAM && ((PlateauCount - 1) < OSLevelCount))
+        {
+            fprintf(Dest, "NOTE: Fewer levels than the OS reports caches - two levels may have merged into one plateau\n");
+        }
+        else if(!PlateauCount)
+        {
+            fprintf(Dest, "No plateaus found\n");
+        }
+    }
+}
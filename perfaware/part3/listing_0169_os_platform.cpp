@@ -59,6 +59,11 @@ static u64 ReadOSTimer(void)
 	return Value.QuadPart;
 }
 
+static void ReadCPUID(u32 Leaf, u32 *Registers)
+{
+    __cpuidex((int *)Registers, Leaf, 0);
+}
+
 static u64 ReadOSPageFaultCount(void)
 {
     PROCESS_MEMORY_COUNTERS_EX MemoryCounters = {};
@@ -215,15 +220,21 @@ inline void CloseMemoryMappedFile(memory_mapped_file *MappedFile)
 #else
 
 #include <x86intrin.h>
+#include <cpuid.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <pthread.h>
 
 struct os_platform
 {
     b32 Initialized;
+    u64 LargePageSize; // NOTE: Always 0; large pages aren't enabled on Linux
     u64 CPUTimerFreq;
 };
 static os_platform GlobalOSPlatform;
@@ -236,20 +247,25 @@ struct memory_mapped_file
 
 static u64 GetOSTimerFreq(void)
 {
-	return 1000000;
+	return 1000000000;
 }
 
 static u64 ReadOSTimer(void)
 {
-	// NOTE(casey): The "struct" keyword is not necessary here when compiling in C++,
-	// but just in case anyone is using this file from C, I include it.
-	struct timeval Value;
-	gettimeofday(&Value, 0);
+	// NOTE: CLOCK_MONOTONIC_RAW is not slewed by NTP, so it can't stretch or squeeze
+	// a short calibration window, and it has nanosecond rather than microsecond resolution.
+	struct timespec Value;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &Value);
 	
-	u64 Result = GetOSTimerFreq()*(u64)Value.tv_sec + (u64)Value.tv_usec;
+	u64 Result = GetOSTimerFreq()*(u64)Value.tv_sec + (u64)Value.tv_nsec;
 	return Result;
 }
 
+static void ReadCPUID(u32 Leaf, u32 *Registers)
+{
+    __cpuid_count(Leaf, 0, Registers[0], Registers[1], Registers[2], Registers[3]);
+}
+
 static u64 ReadOSPageFaultCount(void)
 {
     // NOTE(casey): The course materials are not tested on MacOS/Linux.
@@ -279,7 +295,7 @@ static b32 ReadOSRandomBytes(u64 Count, void *Dest)
     // and do multiple read()'s to make sure you filled the entire buffer.
 
     int DevRandom = open("/dev/urandom", O_RDONLY);
-    b32 Result = (read(DevRandom, Dest.Data, Dest.Count) == Count);
+    b32 Result = (read(DevRandom, Dest, Count) == (ssize_t)Count);
     close(DevRandom);
     
     return Result;
@@ -290,7 +306,7 @@ static u64 GetFileSize(char *FileName)
     struct stat Stat;
     stat(FileName, &Stat);
     
-    return Stat.st_size
+    return Stat.st_size;
 }
 
 static void InitializeOSPlatform(void)
@@ -304,7 +320,11 @@ static void InitializeOSPlatform(void)
 
 static void *OSAllocate(size_t ByteCount)
 {
-    void *Result = mmap(0, ByteCount, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, 0, 0);
+    void *Result = mmap(0, ByteCount, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(Result == MAP_FAILED)
+    {
+        Result = 0;
+    }
     return Result;
 }
 
@@ -313,9 +333,24 @@ static void OSFree(size_t ByteCount, void *BaseAddress)
     munmap(BaseAddress, ByteCount);
 }
 
-inline void CreateThread()
+typedef pthread_t thread_handle;
+typedef void *thread_function(void *);
+#define THREAD_ENTRY_POINT(Name, Parameter) static void *Name(void *Parameter)
+
+inline thread_handle CreateAndStartThread(thread_function *ThreadFunction, void *ThreadParam)
 {
-    IOThread = CreateThread(0, 0, IOThreadRoutine, &ThreadedIO, 0, 0);
+    thread_handle Result = {};
+    if(pthread_create(&Result, 0, ThreadFunction, ThreadParam) != 0)
+    {
+        Result = {};
+    }
+    return Result;
+}
+
+inline b32 IsValidThread(thread_handle Handle)
+{
+    b32 Result = (Handle != 0);
+    return Result;
 }
 
 inline memory_mapped_file OpenMemoryMappedFile(char const *FileName)
@@ -393,32 +428,91 @@ inline u64 GetLargePageSize(void)
     return Result;
 }
 
+static u64 ReadCPUIDTimerFreq(void)
+{
+    // NOTE: Leaf 0x15 gives the TSC as a ratio of the core crystal clock. Some parts
+    // leave the crystal frequency 0, and then the TSC runs at the base frequency in
+    // leaf 0x16. Either way, this is only valid when the TSC is invariant.
+    u64 Result = 0;
+    
+    u32 Registers[4];
+    ReadCPUID(0x80000000, Registers);
+    b32 HasInvariantTSC = false;
+    if(Registers[0] >= 0x80000007)
+    {
+        ReadCPUID(0x80000007, Registers);
+        HasInvariantTSC = ((Registers[3] & (1 << 8)) != 0);
+    }
+    
+    ReadCPUID(0, Registers);
+    u32 MaxLeaf = Registers[0];
+    if(HasInvariantTSC && (MaxLeaf >= 0x15))
+    {
+        ReadCPUID(0x15, Registers);
+        u64 Denominator = Registers[0];
+        u64 Numerator = Registers[1];
+        u64 CrystalFreq = Registers[2];
+        if(Denominator && Numerator)
+        {
+            if(CrystalFreq)
+            {
+                Result = CrystalFreq*Numerator / Denominator;
+            }
+            else if(MaxLeaf >= 0x16)
+            {
+                ReadCPUID(0x16, Registers);
+                Result = (u64)Registers[0]*1000000;
+            }
+        }
+    }
+    
+    return Result;
+}
+
 inline u64 EstimateCPUTimerFreq(void)
 {
-	u64 MillisecondsToWait = 100;
-	u64 OSFreq = GetOSTimerFreq();
-
-	u64 CPUStart = ReadCPUTimer();
-	u64 OSStart = ReadOSTimer();
-	u64 OSEnd = 0;
-	u64 OSElapsed = 0;
-	u64 OSWaitTime = OSFreq * MillisecondsToWait / 1000;
-	while(OSElapsed < OSWaitTime)
-	{
-		OSEnd = ReadOSTimer();
-		OSElapsed = OSEnd - OSStart;
-	}
-	
-	u64 CPUEnd = ReadCPUTimer();
-	u64 CPUElapsed = CPUEnd - CPUStart;
-	
-	u64 CPUFreq = 0;
-	if(OSElapsed)
-	{
-		CPUFreq = OSFreq * CPUElapsed / OSElapsed;
-	}
-	
-	return CPUFreq;
+    u64 Result = ReadCPUIDTimerFreq();
+    if(!Result)
+    {
+        // NOTE: Take the median of a few short windows rather than one long one. An
+        // interrupt that lands in a window only spoils that sample, and the whole
+        // thing takes about 10ms instead of 100ms.
+        u64 MicrosecondsPerSample = 2000;
+        u64 OSFreq = GetOSTimerFreq();
+        u64 OSWaitTime = OSFreq * MicrosecondsPerSample / 1000000;
+        
+        u64 Samples[5];
+        u32 SampleCount = ArrayCount(Samples);
+        for(u32 SampleIndex = 0; SampleIndex < SampleCount; ++SampleIndex)
+        {
+            u64 CPUStart = ReadCPUTimer();
+            u64 OSStart = ReadOSTimer();
+            u64 OSElapsed = 0;
+            while(OSElapsed < OSWaitTime)
+            {
+                OSElapsed = ReadOSTimer() - OSStart;
+            }
+            
+            u64 CPUElapsed = ReadCPUTimer() - CPUStart;
+            Samples[SampleIndex] = OSElapsed ? (OSFreq * CPUElapsed / OSElapsed) : 0;
+        }
+        
+        for(u32 SortIndex = 1; SortIndex < SampleCount; ++SortIndex)
+        {
+            u64 Sample = Samples[SortIndex];
+            u32 InsertIndex = SortIndex;
+            while((InsertIndex > 0) && (Samples[InsertIndex - 1] > Sample))
+            {
+                Samples[InsertIndex] = Samples[InsertIndex - 1];
+                --InsertIndex;
+            }
+            Samples[InsertIndex] = Sample;
+        }
+        
+        Result = Samples[SampleCount / 2];
+    }
+    
+    return Result;
 }
 
 inline void FillWithRandomBytes(buffer Dest)
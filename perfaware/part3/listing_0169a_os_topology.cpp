@@ -0,0 +1,572 @@
+/* ========================================================================
+   OS topology: which CPUs this process may run on, how they group into
+   cores, packages and NUMA nodes, the first CPU's caches, pinning a thread
+   to one of them, and allocating memory on a node. Include after
+   listing_0169_os_platform.cpp.
+   ======================================================================== */
+
+#define MAX_TOPOLOGY_CPUS 1024
+#define MAX_TOPOLOGY_NODES 1024
+#define MAX_TOPOLOGY_CACHES 16
+
+enum cache_type : u32
+{
+    Cache_Unified,
+    Cache_Data,
+    Cache_Instruction,
+};
+
+struct os_cache_info
+{
+    u32 Level;
+    cache_type Type;
+    u64 Size;
+    u32 LineSize;
+    u32 SharedCPUCount; // NOTE: Logical CPUs sharing this cache, including the one it was read for
+};
+
+struct os_cpu_info
+{
+    u32 OSIndex; // NOTE: The OS's own number for this CPU
+    u32 CoreIndex; // NOTE: Physical core, numbered from 0 across all packages
+    u32 SMTIndex; // NOTE: 0 for the first hardware thread of its core, 1 for its sibling, ...
+    u32 PackageIndex;
+    u32 NodeIndex; // NOTE: The OS's NUMA node number, as OSAllocateOnNode takes it
+};
+
+struct os_topology
+{
+    // NOTE: Only the CPUs this process may run on, in the order PinCurrentThreadToCPU numbers them
+    u32 CPUCount;
+    u32 CoreCount;
+    u32 PackageCount;
+    u32 NodeCount;
+    os_cpu_info CPUs[MAX_TOPOLOGY_CPUS];
+    
+    // NOTE: The caches of the first CPU, in the order the OS lists them
+    u32 CacheCount;
+    os_cache_info Caches[MAX_TOPOLOGY_CACHES];
+};
+
+#if _WIN32
+
+inline void JoinThread(thread_handle Handle)
+{
+    WaitForSingleObject(Handle, INFINITE);
+    CloseHandle(Handle);
+}
+
+static u32 CountAffinityBits(KAFFINITY Mask)
+{
+    u32 Result = 0;
+    for(; Mask; Mask &= Mask - 1)
+    {
+        ++Result;
+    }
+    return Result;
+}
+
+#define MAX_CPU_GROUPS 64
+
+/* NOTE: Windows hands out CPUs in processor groups of up to 64, and balances them, so a 96 CPU
+   machine has two groups of 48. CPU indices are dense: the CPUs this process may run on in group 0
+   first, then those in group 1, and so on, so they run from 0 to GetCPUCount() - 1 however full
+   the groups are. A process with an affinity mask is confined to one group and only gets the CPUs
+   in its mask. The active CPUs of a group are the low bits of its mask. */
+struct cpu_group_map
+{
+    u32 GroupCount;
+    u32 CPUCount;
+    KAFFINITY Allowed[MAX_CPU_GROUPS];
+    u32 FirstIndex[MAX_CPU_GROUPS]; // NOTE: The index of the group's first allowed CPU
+};
+
+static void GetCPUGroupMap(cpu_group_map *Map)
+{
+    *Map = {};
+    
+    DWORD_PTR ProcessMask = 0;
+    DWORD_PTR SystemMask = 0;
+    USHORT ProcessGroupCount = 1;
+    USHORT ProcessGroup = 0;
+    b32 Confined = (GetProcessAffinityMask(GetCurrentProcess(), &ProcessMask, &SystemMask) &&
+                    ProcessMask && (ProcessMask != SystemMask) &&
+                    GetProcessGroupAffinity(GetCurrentProcess(), &ProcessGroupCount, &ProcessGroup));
+    
+    Map->GroupCount = GetActiveProcessorGroupCount();
+    if(Map->GroupCount > MAX_CPU_GROUPS)
+    {
+        Map->GroupCount = MAX_CPU_GROUPS;
+    }
+    for(u32 Group = 0; Group < Map->GroupCount; ++Group)
+    {
+        u32 ActiveCount = GetActiveProcessorCount((WORD)Group);
+        KAFFINITY Allowed = (ActiveCount >= 64) ? ~(KAFFINITY)0 : (((KAFFINITY)1 << ActiveCount) - 1);
+        if(Confined)
+        {
+            Allowed = (Group == ProcessGroup) ? (Allowed & ProcessMask) : 0;
+        }
+        
+        Map->Allowed[Group] = Allowed;
+        Map->FirstIndex[Group] = Map->CPUCount;
+        Map->CPUCount += CountAffinityBits(Allowed);
+    }
+}
+
+// NOTE: Returns Map->CPUCount for a CPU the process may not run on
+static u32 GetDenseCPUIndex(cpu_group_map *Map, u32 Group, u32 Bit)
+{
+    u32 Result = Map->CPUCount;
+    if((Group < Map->GroupCount) && (Bit < 64) && ((Map->Allowed[Group] >> Bit) & 1))
+    {
+        KAFFINITY Below = ((KAFFINITY)1 << Bit) - 1;
+        Result = Map->FirstIndex[Group] + CountAffinityBits(Map->Allowed[Group] & Below);
+    }
+    return Result;
+}
+
+// NOTE: CPUs are counted within the process's affinity, so a job object or start /affinity limits what the tests use
+inline u32 GetCPUCount(void)
+{
+    cpu_group_map Map;
+    GetCPUGroupMap(&Map);
+    u32 Result = Map.CPUCount;
+    return Result;
+}
+
+// NOTE: CPUIndex is the dense index described at cpu_group_map, not Group*64 + bit
+inline b32 PinCurrentThreadToCPU(u32 CPUIndex)
+{
+    b32 Result = false;
+    cpu_group_map Map;
+    GetCPUGroupMap(&Map);
+    for(u32 Group = 0; Group < Map.GroupCount; ++Group)
+    {
+        for(u32 Bit = 0; Bit < 64; ++Bit)
+        {
+            if((CPUIndex < Map.CPUCount) && (GetDenseCPUIndex(&Map, Group, Bit) == CPUIndex))
+            {
+                GROUP_AFFINITY Affinity = {};
+                Affinity.Group = (WORD)Group;
+                Affinity.Mask = (KAFFINITY)1 << Bit;
+                Result = SetThreadGroupAffinity(GetCurrentThread(), &Affinity, 0);
+            }
+        }
+    }
+    return Result;
+}
+
+static void *OSAllocateOnNode(size_t ByteCount, u32 NodeIndex)
+{
+    void *Result = VirtualAllocExNuma(GetCurrentProcess(), 0, ByteCount, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE, NodeIndex);
+    return Result;
+}
+
+// NOTE: CPUs are indexed the way PinCurrentThreadToCPU takes them; OSIndex is Group*64 + bit
+static void ReadOSTopology(os_topology *Topology)
+{
+    cpu_group_map Map;
+    GetCPUGroupMap(&Map);
+    
+    Topology->CPUCount = Map.CPUCount;
+    if(Topology->CPUCount > MAX_TOPOLOGY_CPUS)
+    {
+        Topology->CPUCount = MAX_TOPOLOGY_CPUS;
+    }
+    for(u32 Group = 0; Group < Map.GroupCount; ++Group)
+    {
+        for(u32 Bit = 0; Bit < 64; ++Bit)
+        {
+            u32 CPUIndex = GetDenseCPUIndex(&Map, Group, Bit);
+            if(CPUIndex < Topology->CPUCount)
+            {
+                Topology->CPUs[CPUIndex].OSIndex = Group*64 + Bit;
+            }
+        }
+    }
+    
+    DWORD Size = 0;
+    GetLogicalProcessorInformationEx(RelationAll, 0, &Size);
+    buffer Info = AllocateBuffer(Size);
+    if(IsValid(Info) &&
+       GetLogicalProcessorInformationEx(RelationAll, (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)Info.Data, &Size))
+    {
+        u64 NodeSeen[MAX_TOPOLOGY_NODES / 64] = {};
+        for(u8 *At = Info.Data; At < (Info.Data + Size);)
+        {
+            SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *Entry = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)At;
+            At += Entry->Size;
+            
+            if((Entry->Relationship == RelationProcessorCore) ||
+               (Entry->Relationship == RelationProcessorPackage))
+            {
+                b32 IsCore = (Entry->Relationship == RelationProcessorCore);
+                u32 SMTIndex = 0;
+                for(u32 GroupIndex = 0; GroupIndex < Entry->Processor.GroupCount; ++GroupIndex)
+                {
+                    GROUP_AFFINITY *Group = &Entry->Processor.GroupMask[GroupIndex];
+                    for(u32 Bit = 0; Bit < 64; ++Bit)
+                    {
+                        u32 CPUIndex = GetDenseCPUIndex(&Map, Group->Group, Bit);
+                        if(((Group->Mask >> Bit) & 1) && (CPUIndex < Topology->CPUCount))
+                        {
+                            if(IsCore)
+                            {
+                                Topology->CPUs[CPUIndex].CoreIndex = Topology->CoreCount;
+                                Topology->CPUs[CPUIndex].SMTIndex = SMTIndex++;
+                            }
+                            else
+                            {
+                                Topology->CPUs[CPUIndex].PackageIndex = Topology->PackageCount;
+                            }
+                        }
+                    }
+                }
+                
+                if(IsCore)
+                {
+                    ++Topology->CoreCount;
+                }
+                else
+                {
+                    ++Topology->PackageCount;
+                }
+            }
+            else if(Entry->Relationship == RelationNumaNode)
+            {
+                u32 NodeIndex = Entry->NumaNode.NodeNumber;
+                GROUP_AFFINITY *Group = &Entry->NumaNode.GroupMask;
+                for(u32 Bit = 0; Bit < 64; ++Bit)
+                {
+                    u32 CPUIndex = GetDenseCPUIndex(&Map, Group->Group, Bit);
+                    if(((Group->Mask >> Bit) & 1) && (CPUIndex < Topology->CPUCount))
+                    {
+                        Topology->CPUs[CPUIndex].NodeIndex = NodeIndex;
+                    }
+                }
+                
+                if((NodeIndex < MAX_TOPOLOGY_NODES) && !(NodeSeen[NodeIndex / 64] & (1ull << (NodeIndex % 64))))
+                {
+                    NodeSeen[NodeIndex / 64] |= (1ull << (NodeIndex % 64));
+                    ++Topology->NodeCount;
+                }
+            }
+            else if(Entry->Relationship == RelationCache)
+            {
+                CACHE_RELATIONSHIP *Cache = &Entry->Cache;
+                b32 HasFirstCPU = false;
+                for(u32 Bit = 0; Bit < 64; ++Bit)
+                {
+                    if(((Cache->GroupMask.Mask >> Bit) & 1) &&
+                       (GetDenseCPUIndex(&Map, Cache->GroupMask.Group, Bit) == 0) && Map.CPUCount)
+                    {
+                        HasFirstCPU = true;
+                    }
+                }
+                
+                if(HasFirstCPU && (Topology->CacheCount < MAX_TOPOLOGY_CACHES))
+                {
+                    os_cache_info *Dest = Topology->Caches + Topology->CacheCount++;
+                    Dest->Level = Cache->Level;
+                    Dest->Type = ((Cache->Type == CacheData) ? Cache_Data :
+                                  (Cache->Type == CacheInstruction) ? Cache_Instruction : Cache_Unified);
+                    Dest->Size = Cache->CacheSize;
+                    Dest->LineSize = Cache->LineSize;
+                    Dest->SharedCPUCount = CountAffinityBits(Cache->GroupMask.Mask);
+                }
+            }
+        }
+    }
+    FreeBuffer(&Info);
+    
+    if(!Topology->NodeCount)
+    {
+        Topology->NodeCount = 1;
+    }
+}
+
+#else
+
+#include <sched.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+inline void JoinThread(thread_handle Handle)
+{
+    pthread_join(Handle, 0);
+}
+
+// NOTE: CPUs are counted within the process's affinity mask, so a cpuset or taskset limits what the tests use
+inline u32 GetCPUCount(void)
+{
+    u32 Result = 1;
+    cpu_set_t Allowed;
+    if(sched_getaffinity(getpid(), sizeof(Allowed), &Allowed) == 0)
+    {
+        Result = CPU_COUNT(&Allowed);
+    }
+    return Result;
+}
+
+// NOTE: CPUIndex is the index within the process's affinity mask, not the OS CPU number
+inline b32 PinCurrentThreadToCPU(u32 CPUIndex)
+{
+    b32 Result = false;
+    cpu_set_t Allowed;
+    if(sched_getaffinity(getpid(), sizeof(Allowed), &Allowed) == 0)
+    {
+        for(u32 CPU = 0; CPU < CPU_SETSIZE; ++CPU)
+        {
+            if(CPU_ISSET(CPU, &Allowed) && (CPUIndex-- == 0))
+            {
+                cpu_set_t Set;
+                CPU_ZERO(&Set);
+                CPU_SET(CPU, &Set);
+                Result = (pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set) == 0);
+                break;
+            }
+        }
+    }
+    return Result;
+}
+
+// NOTE: mbind only sets the policy; the pages land on the node when they are first touched
+static void *OSAllocateOnNode(size_t ByteCount, u32 NodeIndex)
+{
+    void *Result = 0;
+    if(NodeIndex < MAX_TOPOLOGY_NODES)
+    {
+        Result = OSAllocate(ByteCount);
+        if(Result)
+        {
+            // NOTE: maxnode is one more than the bits in the mask, because the kernel ignores the last one
+            unsigned long NodeMask[MAX_TOPOLOGY_NODES / (8*sizeof(unsigned long))] = {};
+            NodeMask[NodeIndex / (8*sizeof(unsigned long))] = 1ul << (NodeIndex % (8*sizeof(unsigned long)));
+            if(syscall(SYS_mbind, Result, ByteCount, MPOL_BIND, NodeMask, 8*sizeof(NodeMask) + 1, 0) != 0)
+            {
+                // NOTE: A kernel without NUMA support only has node 0, and everything is already on it
+                if((errno != ENOSYS) || (NodeIndex != 0))
+                {
+                    OSFree(ByteCount, Result);
+                    Result = 0;
+                }
+            }
+        }
+    }
+    return Result;
+}
+
+static b32 ReadSysFile(char const *Path, char *Dest, u32 DestSize)
+{
+    b32 Result = false;
+    FILE *File = fopen(Path, "rb");
+    if(File)
+    {
+        size_t Count = fread(Dest, 1, DestSize - 1, File);
+        Dest[Count] = 0;
+        Result = (Count > 0);
+        fclose(File);
+    }
+    return Result;
+}
+
+// NOTE: Also takes the K/M/G suffixes the cache sizes use
+static u64 ReadSysNumber(char const *Path)
+{
+    u64 Result = 0;
+    char Text[64];
+    if(ReadSysFile(Path, Text, sizeof(Text)))
+    {
+        char *End = Text;
+        Result = strtoull(Text, &End, 10);
+        if(*End == 'K') Result <<= 10;
+        else if(*End == 'M') Result <<= 20;
+        else if(*End == 'G') Result <<= 30;
+    }
+    return Result;
+}
+
+// NOTE: Counts the CPUs in a kernel CPU list like "0-3,8-11"
+static u32 CountCPUList(char const *List)
+{
+    u32 Result = 0;
+    char const *At = List;
+    while((*At >= '0') && (*At <= '9'))
+    {
+        char *End = 0;
+        u32 First = (u32)strtoul(At, &End, 10);
+        u32 Last = First;
+        if(*End == '-')
+        {
+            Last = (u32)strtoul(End + 1, &End, 10);
+        }
+        Result += Last - First + 1;
+        
+        At = End;
+        if(*At == ',')
+        {
+            ++At;
+        }
+    }
+    return Result;
+}
+
+// NOTE: The kernel shows a CPU's node as a nodeN link in its sysfs directory
+static u32 ReadCPUNode(u32 OSIndex)
+{
+    u32 Result = 0;
+    char Path[128];
+    snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%u", OSIndex);
+    DIR *Dir = opendir(Path);
+    if(Dir)
+    {
+        while(dirent *Entry = readdir(Dir))
+        {
+            if((strncmp(Entry->d_name, "node", 4) == 0) &&
+               (Entry->d_name[4] >= '0') && (Entry->d_name[4] <= '9'))
+            {
+                Result = (u32)strtoul(Entry->d_name + 4, 0, 10);
+                break;
+            }
+        }
+        closedir(Dir);
+    }
+    return Result;
+}
+
+static void ReadOSTopology(os_topology *Topology)
+{
+    cpu_set_t Allowed;
+    if(sched_getaffinity(getpid(), sizeof(Allowed), &Allowed) != 0)
+    {
+        CPU_ZERO(&Allowed);
+        CPU_SET(0, &Allowed);
+    }
+    
+    u32 CoreIDs[MAX_TOPOLOGY_CPUS];
+    u32 PackageIDs[MAX_TOPOLOGY_CPUS];
+    u64 NodeSeen[MAX_TOPOLOGY_NODES / 64] = {};
+    char Path[128];
+    for(u32 OSIndex = 0; (OSIndex < CPU_SETSIZE) && (Topology->CPUCount < MAX_TOPOLOGY_CPUS); ++OSIndex)
+    {
+        if(CPU_ISSET(OSIndex, &Allowed))
+        {
+            u32 CPUIndex = Topology->CPUCount++;
+            os_cpu_info *CPU = Topology->CPUs + CPUIndex;
+            CPU->OSIndex = OSIndex;
+            
+            snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%u/topology/core_id", OSIndex);
+            CoreIDs[CPUIndex] = (u32)ReadSysNumber(Path);
+            snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", OSIndex);
+            PackageIDs[CPUIndex] = (u32)ReadSysNumber(Path);
+            
+            // NOTE: core_id is only unique within a package, and neither is dense, so both get renumbered
+            CPU->CoreIndex = Topology->CoreCount;
+            CPU->PackageIndex = Topology->PackageCount;
+            b32 NewCore = true;
+            b32 NewPackage = true;
+            for(u32 Earlier = 0; Earlier < CPUIndex; ++Earlier)
+            {
+                if(PackageIDs[Earlier] == PackageIDs[CPUIndex])
+                {
+                    CPU->PackageIndex = Topology->CPUs[Earlier].PackageIndex;
+                    NewPackage = false;
+                    
+                    if(CoreIDs[Earlier] == CoreIDs[CPUIndex])
+                    {
+                        CPU->CoreIndex = Topology->CPUs[Earlier].CoreIndex;
+                        ++CPU->SMTIndex;
+                        NewCore = false;
+                    }
+                }
+            }
+            Topology->CoreCount += NewCore;
+            Topology->PackageCount += NewPackage;
+            
+            CPU->NodeIndex = ReadCPUNode(OSIndex);
+            if((CPU->NodeIndex < MAX_TOPOLOGY_NODES) && !(NodeSeen[CPU->NodeIndex / 64] & (1ull << (CPU->NodeIndex % 64))))
+            {
+                NodeSeen[CPU->NodeIndex / 64] |= (1ull << (CPU->NodeIndex % 64));
+                ++Topology->NodeCount;
+            }
+        }
+    }
+    
+    if(Topology->CPUCount)
+    {
+        u32 OSIndex = Topology->CPUs[0].OSIndex;
+        for(u32 CacheIndex = 0; CacheIndex < MAX_TOPOLOGY_CACHES; ++CacheIndex)
+        {
+            snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", OSIndex, CacheIndex);
+            u32 Level = (u32)ReadSysNumber(Path);
+            if(!Level)
+            {
+                break;
+            }
+            
+            os_cache_info *Cache = Topology->Caches + Topology->CacheCount++;
+            Cache->Level = Level;
+            
+            char Text[256];
+            snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%u/cache/index%u/type", OSIndex, CacheIndex);
+            Cache->Type = Cache_Unified;
+            if(ReadSysFile(Path, Text, sizeof(Text)))
+            {
+                if(strncmp(Text, "Data", 4) == 0) Cache->Type = Cache_Data;
+                else if(strncmp(Text, "Instruction", 11) == 0) Cache->Type = Cache_Instruction;
+            }
+            
+            snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%u/cache/index%u/size", OSIndex, CacheIndex);
+            Cache->Size = ReadSysNumber(Path);
+            snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%u/cache/index%u/coherency_line_size", OSIndex, CacheIndex);
+            Cache->LineSize = (u32)ReadSysNumber(Path);
+            snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list", OSIndex, CacheIndex);
+            if(ReadSysFile(Path, Text, sizeof(Text)))
+            {
+                Cache->SharedCPUCount = CountCPUList(Text);
+            }
+        }
+    }
+    
+    if(!Topology->NodeCount)
+    {
+        Topology->NodeCount = 1;
+    }
+}
+
+#endif
+
+static b32 GlobalOSTopologyRead;
+static os_topology GlobalOSTopology;
+
+// NOTE: Read on first use. Call it from the main thread before starting any threads that need it.
+inline os_topology *GetOSTopology(void)
+{
+    if(!GlobalOSTopologyRead)
+    {
+        GlobalOSTopologyRead = true;
+        ReadOSTopology(&GlobalOSTopology);
+    }
+    
+    os_topology *Result = &GlobalOSTopology;
+    return Result;
+}
+
+inline buffer AllocateBufferOnNode(size_t Count, u32 NodeIndex)
+{
+    buffer Result = {};
+    Result.Data = (u8 *)OSAllocateOnNode(Count, NodeIndex);
+    if(Result.Data)
+    {
+        Result.Count = Count;
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to allocate %llu bytes on node %u.\n", (unsigned long long)Count, NodeIndex);
+    }
+    
+    return Result;
+}
@@ -0,0 +1,186 @@
+/* ========================================================================
+   Parallel bandwidth: runs a read kernel on 1 thread, then 2, and so on up
+   to the CPU count, each thread reading its own buffer allocated on the
+   node of the CPU it runs on, and prints the total gb/s for each thread
+   count as CSV.
+   
+   Usage: parallel_bandwidth_main [max threads] [mb per thread] [spread|compact|os]
+   ======================================================================== */
+
+/* NOTE(casey): _CRT_SECURE_NO_WARNINGS is here because otherwise we cannot
+   call fopen(). If we replace fopen() with fopen_s() to avoid the warning,
+   then the code doesn't compile on Linux anymore, since fopen_s() does not
+   exist there.
+   
+   What exactly the CRT maintainers were thinking when they made this choice,
+   I have no idea. */
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int32_t b32;
+
+typedef float f32;
+typedef double f64;
+
+#define ArrayCount(Array) (sizeof(Array)/sizeof((Array)[0]))
+
+#include "listing_0125_buffer.cpp"
+#include "listing_0169_os_platform.cpp"
+#include "listing_0169a_os_topology.cpp"
+#include "listing_0164_csv_repetition_tester.cpp"
+#include "listing_0164a_parallel_tester.cpp"
+#include "listing_0164b_test_baseline.cpp"
+
+struct parallel_read_data
+{
+    u64 BytesPerThread;
+    buffer Buffers[MAX_TOPOLOGY_CPUS]; // NOTE: One per thread, on that thread's node
+};
+
+static parallel_read_data GlobalReadData;
+static u64 volatile GlobalReadSinks[MAX_TOPOLOGY_CPUS*8];
+
+/* NOTE: Reads the thread's whole buffer with two 32-byte loads per 64-byte line, feeding two
+   independent xor chains, like ReadRegion_32x2 in cache_sweep_main. Each thread leaves its sum in
+   its own cache line of GlobalReadSinks, so the threads never share a line. */
+static void ReadBuffer_32x2(repetition_tester *Tester, u32 ThreadIndex, void *Data)
+{
+    parallel_read_data *Read = (parallel_read_data *)Data;
+    buffer Buffer = Read->Buffers[ThreadIndex];
+    
+    __m256i SumA = _mm256_setzero_si256();
+    __m256i SumB = _mm256_setzero_si256();
+    
+    BeginTime(Tester);
+    u8 *At = Buffer.Data;
+    for(u64 LineIndex = 0; LineIndex < Read->BytesPerThread / 64; ++LineIndex)
+    {
+        SumA = _mm256_xor_si256(SumA, _mm256_loadu_si256((__m256i *)At));
+        SumB = _mm256_xor_si256(SumB, _mm256_loadu_si256((__m256i *)(At + 32)));
+        At += 64;
+    }
+    EndTime(Tester);
+    CountBytes(Tester, Read->BytesPerThread);
+    
+    __m256i Sum = _mm256_xor_si256(SumA, SumB);
+    GlobalReadSinks[ThreadIndex*8] = (u64)_mm256_extract_epi64(Sum, 0);
+}
+
+int main(int ArgCount, char **Args)
+{
+    InitializeOSPlatform();
+    
+    int Result = 0;
+    
+    os_topology *Topology = GetOSTopology();
+    u32 MaxThreadCount = Topology->CPUCount;
+    u64 BytesPerThread = 64ull*1024*1024;
+    thread_placement Placement = Placement_Spread;
+    char const *PlacementName = "spread";
+    b32 ValidArgs = true;
+    
+    if(ArgCount > 1)
+    {
+        MaxThreadCount = (u32)strtoul(Args[1], 0, 10);
+    }
+    if(ArgCount > 2)
+    {
+        BytesPerThread = strtoull(Args[2], 0, 10)*1024*1024;
+    }
+    if(ArgCount > 3)
+    {
+        PlacementName = Args[3];
+        if(strcmp(PlacementName, "spread") == 0)
+        {
+            Placement = Placement_Spread;
+        }
+        else if(strcmp(PlacementName, "compact") == 0)
+        {
+            Placement = Placement_Compact;
+        }
+        else if(strcmp(PlacementName, "os") == 0)
+        {
+            Placement = Placement_OSOrder;
+        }
+        else
+        {
+            ValidArgs = false;
+        }
+    }
+    
+    if(ValidArgs && MaxThreadCount && (MaxThreadCount <= MAX_TOPOLOGY_CPUS) && BytesPerThread)
+    {
+        parallel_read_data *Read = &GlobalReadData;
+        Read->BytesPerThread = BytesPerThread;
+        
+        // NOTE: Thread N gets the same CPU at every thread count, so its buffer can be allocated once,
+        // on that CPU's node, and written once so the OS has mapped it before the first test.
+        b32 Allocated = true;
+        for(u32 ThreadIndex = 0; ThreadIndex < MaxThreadCount; ++ThreadIndex)
+        {
+            u32 CPUIndex = GetPlacementCPUIndex(Placement, ThreadIndex);
+            buffer *Buffer = Read->Buffers + ThreadIndex;
+            *Buffer = AllocateBufferOnNode(BytesPerThread, Topology->CPUs[CPUIndex].NodeIndex);
+            if(!IsValid(*Buffer))
+            {
+                Allocated = false;
+                break;
+            }
+            
+            for(u64 ByteIndex = 0; ByteIndex < Buffer->Count; ++ByteIndex)
+            {
+                Buffer->Data[ByteIndex] = (u8)ByteIndex;
+            }
+        }
+        
+        repetition_test_series Series = AllocateTestSeries(1, MaxThreadCount);
+        if(Allocated && IsValid(Series))
+        {
+            SetRowLabelLabel(&Series, "Threads");
+            for(u32 ThreadCount = 1; ThreadCount <= MaxThreadCount; ++ThreadCount)
+            {
+                SetRowLabel(&Series, "%u", ThreadCount);
+                SetColumnLabel(&Series, "ReadBuffer_32x2 %s", PlacementName);
+                
+                // NOTE: A parallel tester keeps its thread count, so every row gets a new one
+                parallel_repetition_tester Parallel = {};
+                Parallel.Placement = Placement;
+                Parallel.Aggregate.ConvergenceTolerance = 0.01;
+                RunParallelTestWave(&Series, &Parallel, ThreadCount, ReadBuffer_32x2, Read,
+                                    BytesPerThread, GetCPUTimerFreq(), 3);
+                FreeParallelTester(&Parallel);
+            }
+            
+            PrintCSVForValue(&Series, StatValue_GBPerSecond, stdout);
+            Result = CheckTestSeriesBaseline(&Series);
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unable to allocate the test buffers\n");
+            Result = 1;
+        }
+        
+        FreeTestSeries(&Series);
+        for(u32 ThreadIndex = 0; ThreadIndex < MaxThreadCount; ++ThreadIndex)
+        {
+            FreeBuffer(Read->Buffers + ThreadIndex);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Usage: %s [max threads] [mb per thread] [spread|compact|os]\n", Args[0]);
+        Result = 1;
+    }
+    
+    return Result;
+}
@@ -30,13 +30,191 @@ enum repetition_value_type
     RepValue_MemPageFaults,
     RepValue_ByteCount,
     
+    // NOTE: Hardware counters, in the order ReadPerfCounters fills them.
+    // They stay 0 when the platform can't read them.
+    RepValue_Instructions,
+    RepValue_Cycles,
+    RepValue_L1DMisses,
+    RepValue_LLCMisses,
+    RepValue_BranchMisses,
+    
     StatValue_Seconds,
     StatValue_GBPerSecond,
     StatValue_KBPerPageFault,
+    StatValue_IPC,
     
     RepValue_Count,
 };
 
+#define PERF_COUNTER_COUNT (RepValue_BranchMisses - RepValue_Instructions + 1)
+
+#if __linux__
+
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct perf_counters
+{
+    b32 Initialized;
+    int FDs[PERF_COUNTER_COUNT];
+    perf_event_mmap_page volatile *Pages[PERF_COUNTER_COUNT];
+};
+// NOTE: The events only count the thread that opened them, so every test thread gets its own
+static thread_local perf_counters GlobalPerfCounters;
+
+static void InitializePerfCounters(void)
+{
+    perf_counters *Counters = &GlobalPerfCounters;
+    if(!Counters->Initialized)
+    {
+        Counters->Initialized = true;
+        
+        u32 Types[PERF_COUNTER_COUNT] =
+        {
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HW_CACHE,
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HARDWARE,
+        };
+        u64 Configs[PERF_COUNTER_COUNT] =
+        {
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        
+        // NOTE: Each event is opened on its own, so a PMU that lacks one of them
+        // (common in VMs) only loses that counter. Counting is user mode only.
+        for(u32 Index = 0; Index < PERF_COUNTER_COUNT; ++Index)
+        {
+            perf_event_attr Attr = {};
+            Attr.size = sizeof(Attr);
+            Attr.type = Types[Index];
+            Attr.config = Configs[Index];
+            Attr.exclude_kernel = 1;
+            Attr.exclude_hv = 1;
+            
+            Counters->FDs[Index] = (int)syscall(SYS_perf_event_open, &Attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+            Counters->Pages[Index] = 0;
+            if(Counters->FDs[Index] >= 0)
+            {
+                void *Page = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, Counters->FDs[Index], 0);
+                if(Page != MAP_FAILED)
+                {
+                    Counters->Pages[Index] = (perf_event_mmap_page *)Page;
+                }
+            }
+        }
+        
+        // NOTE: Only said once, not once per test thread
+        static b32 Reported;
+        if((Counters->FDs[0] < 0) && !Reported)
+        {
+            Reported = true;
+            fprintf(stderr, "NOTE: Hardware counters unavailable\n");
+        }
+    }
+}
+
+static u64 ReadPerfCounter(u32 Index)
+{
+    perf_counters *Counters = &GlobalPerfCounters;
+    perf_event_mmap_page volatile *Page = Counters->Pages[Index];
+    
+    u64 Result = 0;
+    b32 ReadWithRDPMC = false;
+    if(Page)
+    {
+        // NOTE: Sequence-locked rdpmc read, as described in linux/perf_event.h.
+        // The kernel bumps Lock whenever it reschedules the event.
+        u32 Sequence;
+        do
+        {
+            Sequence = Page->lock;
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            
+            u32 PMCIndex = Page->index;
+            Result = Page->offset;
+            ReadWithRDPMC = (Page->cap_user_rdpmc && PMCIndex);
+            if(ReadWithRDPMC)
+            {
+                // NOTE: The hardware counter is only pmc_width bits wide, so it has to be sign extended
+                u32 Shift = 64 - Page->pmc_width;
+                int64_t PMC = (int64_t)__rdpmc(PMCIndex - 1);
+                Result += (u64)((PMC << Shift) >> Shift);
+            }
+            
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        } while(Page->lock != Sequence);
+    }
+    
+    if(!ReadWithRDPMC && (Counters->FDs[Index] >= 0))
+    {
+        // NOTE: The event isn't on a hardware counter right now (or rdpmc is disabled), so ask the kernel
+        Result = 0;
+        if(read(Counters->FDs[Index], &Result, sizeof(Result)) != sizeof(Result))
+        {
+            Result = 0;
+        }
+    }
+    
+    return Result;
+}
+
+static void ReadPerfCounters(u64 *Values)
+{
+    for(u32 Index = 0; Index < PERF_COUNTER_COUNT; ++Index)
+    {
+        Values[Index] = ReadPerfCounter(Index);
+    }
+}
+
+inline void ClosePerfCounters(void)
+{
+    perf_counters *Counters = &GlobalPerfCounters;
+    if(Counters->Initialized)
+    {
+        for(u32 Index = 0; Index < PERF_COUNTER_COUNT; ++Index)
+        {
+            if(Counters->Pages[Index])
+            {
+                munmap((void *)Counters->Pages[Index], sysconf(_SC_PAGESIZE));
+            }
+            if(Counters->FDs[Index] >= 0)
+            {
+                close(Counters->FDs[Index]);
+            }
+        }
+        *Counters = {};
+    }
+}
+
+#else
+
+// NOTE: There is no user-mode counter API on other platforms, so the counters just stay 0
+static void InitializePerfCounters(void)
+{
+}
+
+static void ReadPerfCounters(u64 *Values)
+{
+    for(u32 Index = 0; Index < PERF_COUNTER_COUNT; ++Index)
+    {
+        Values[Index] = 0;
+    }
+}
+
+inline void ClosePerfCounters(void)
+{
+}
+
+#endif
+
 struct repetition_value
 {
     u64 E[RepValue_Count];
@@ -50,8 +228,20 @@ struct repetition_test_results
     repetition_value Total;
     repetition_value Min;
     repetition_value Max;
+    
+    // NOTE: From the time of every test kept in the tester's sample buffer. Only the CPU timer and
+    // byte count (and the seconds and gb/s derived from them) are filled in.
+    u64 SampleCount;
+    repetition_value Median;
+    repetition_value MAD; // NOTE: Median absolute deviation from the median
+    repetition_value P5;
+    repetition_value P95;
+    repetition_value MinCIHigh; // NOTE: Upper end of the 95% bootstrap interval for Min; the lower end is Min itself
 };
 
+#define DEFAULT_MAX_SAMPLE_COUNT (1024*1024)
+#define MIN_CONVERGENCE_SAMPLE_COUNT 32
+
 struct repetition_tester
 {
     u64 TargetProcessedByteCount;
@@ -61,11 +251,27 @@ struct repetition_tester
     
     test_mode Mode;
     b32 PrintNewMinimums;
+    b32 Quiet; // NOTE: Don't print the results when the test completes
     u32 OpenBlockCount;
     u32 CloseBlockCount;
     
     repetition_value AccumulatedOnThisTest;
     repetition_test_results Results;
+    
+    // NOTE: Set MaxSampleCount before the first NewTestWave to change the size of the sample buffer.
+    // Once it is full, the statistics cover the first MaxSampleCount tests.
+    buffer SampleMemory;
+    u64 *Samples; // NOTE: CPU time of each test, [MaxSampleCount]
+    u64 MaxSampleCount;
+    u64 SampleCount;
+    
+    // NOTE: Set ConvergenceTolerance to finish a wave as soon as the 95% interval for the min is
+    // narrower than that fraction of it (0.01 = 1%), instead of waiting out SecondsToTry. It is off
+    // (0) by default, so a wave still gets the whole SecondsToTry for page faults and clock
+    // frequency to settle unless the caller opts in.
+    f64 ConvergenceTolerance;
+    u64 SmallestTimes[4];
+    u64 TestsSinceNewMin;
 };
 
 struct repetition_series_label
@@ -128,6 +334,12 @@ static void ComputeDerivedValues(repetition_value *Value, u64 CPUTimerFreq)
     {
         PerCount[StatValue_KBPerPageFault] = PerCount[RepValue_ByteCount] / (PerCount[RepValue_MemPageFaults] * 1024.0);
     }
+    
+    // NOTE: These are core cycles from the PMU, not TSC ticks, so IPC stays right when the core isn't running at the TSC frequency
+    if(PerCount[RepValue_Cycles] > 0)
+    {
+        PerCount[StatValue_IPC] = PerCount[RepValue_Instructions] / PerCount[RepValue_Cycles];
+    }
 }
 
 static void PrintValue(char const *Label, repetition_value Value)
@@ -143,6 +355,21 @@ static void PrintValue(char const *Label, repetition_value Value)
     {
         printf(" PF: %0.4f (%0.4fk/fault)", Value.PerCount[RepValue_MemPageFaults], Value.PerCount[StatValue_KBPerPageFault]);
     }
+    
+    if(Value.PerCount[StatValue_IPC])
+    {
+        printf(" IPC: %0.2f", Value.PerCount[StatValue_IPC]);
+    }
+    
+    // NOTE: Misses per thousand instructions
+    f64 Instructions = Value.PerCount[RepValue_Instructions];
+    if(Instructions > 0)
+    {
+        printf(" L1D: %0.2f LLC: %0.2f BR: %0.2f (per ki)",
+               1000.0*Value.PerCount[RepValue_L1DMisses] / Instructions,
+               1000.0*Value.PerCount[RepValue_LLCMisses] / Instructions,
+               1000.0*Value.PerCount[RepValue_BranchMisses] / Instructions);
+    }
 }
 
 static void PrintResults(repetition_test_results Results)
@@ -153,6 +380,18 @@ static void PrintResults(repetition_test_results Results)
     printf("\n");
     PrintValue("Avg", Results.Total);
     printf("\n");
+    
+    if(Results.SampleCount)
+    {
+        PrintValue("Median", Results.Median);
+        f64 MADPercent = Results.Median.PerCount[RepValue_CPUTimer] ? (100.0*Results.MAD.PerCount[RepValue_CPUTimer] / Results.Median.PerCount[RepValue_CPUTimer]) : 0;
+        printf(" MAD: %fms (%.2f%%)\n", 1000.0*Results.MAD.PerCount[StatValue_Seconds], MADPercent);
+        printf("P5-P95: %fms-%fms\n",
+               1000.0*Results.P5.PerCount[StatValue_Seconds], 1000.0*Results.P95.PerCount[StatValue_Seconds]);
+        printf("Min 95%% CI: %fms-%fms (%llu samples)\n",
+               1000.0*Results.Min.PerCount[StatValue_Seconds], 1000.0*Results.MinCIHigh.PerCount[StatValue_Seconds],
+               (unsigned long long)Results.SampleCount);
+    }
 }
 
 static void Error(repetition_tester *Tester, char const *Message)
@@ -170,6 +409,22 @@ static void NewTestWave(repetition_tester *Tester, u64 TargetProcessedByteCount,
         Tester->CPUTimerFreq = CPUTimerFreq;
         Tester->PrintNewMinimums = true;
         Tester->Results.Min.E[RepValue_CPUTimer] = (u64)-1;
+        
+        // NOTE: Allocated up front, so recording a sample never allocates in the middle of a test
+        if(!Tester->MaxSampleCount)
+        {
+            Tester->MaxSampleCount = DEFAULT_MAX_SAMPLE_COUNT;
+        }
+        Tester->SampleMemory = AllocateBuffer(Tester->MaxSampleCount*sizeof(u64));
+        Tester->Samples = (u64 *)Tester->SampleMemory.Data;
+        if(!Tester->Samples)
+        {
+            Tester->MaxSampleCount = 0;
+        }
+        for(u32 Index = 0; Index < ArrayCount(Tester->SmallestTimes); ++Index)
+        {
+            Tester->SmallestTimes[Index] = (u64)-1;
+        }
     }
     else if(Tester->Mode == TestMode_Completed)
     {
@@ -186,6 +441,8 @@ static void NewTestWave(repetition_tester *Tester, u64 TargetProcessedByteCount,
         }
     }
 
+    InitializePerfCounters();
+    
     Tester->TryForTime = SecondsToTry*CPUTimerFreq;
     Tester->TestsStartedAt = ReadCPUTimer();
 }
@@ -195,6 +452,15 @@ static void BeginTime(repetition_tester *Tester)
     ++Tester->OpenBlockCount;
     
     repetition_value *Accum = &Tester->AccumulatedOnThisTest;
+    
+    // NOTE: Counters are read outside the timer reads, so their cost isn't charged to the test
+    u64 Counters[PERF_COUNTER_COUNT];
+    ReadPerfCounters(Counters);
+    for(u32 Index = 0; Index < PERF_COUNTER_COUNT; ++Index)
+    {
+        Accum->E[RepValue_Instructions + Index] -= Counters[Index];
+    }
+    
     Accum->E[RepValue_MemPageFaults] -= ReadOSPageFaultCount();
     Accum->E[RepValue_CPUTimer] -= ReadCPUTimer();
 }
@@ -204,6 +470,13 @@ static void EndTime(repetition_tester *Tester)
     repetition_value *Accum = &Tester->AccumulatedOnThisTest;
     Accum->E[RepValue_CPUTimer] += ReadCPUTimer();
     Accum->E[RepValue_MemPageFaults] += ReadOSPageFaultCount();
+    
+    u64 Counters[PERF_COUNTER_COUNT];
+    ReadPerfCounters(Counters);
+    for(u32 Index = 0; Index < PERF_COUNTER_COUNT; ++Index)
+    {
+        Accum->E[RepValue_Instructions + Index] += Counters[Index];
+    }
 
     ++Tester->CloseBlockCount;
 }
@@ -214,6 +487,185 @@ static void CountBytes(repetition_tester *Tester, u64 ByteCount)
     Accum->E[RepValue_ByteCount] += ByteCount;
 }
 
+static void FreeTestSamples(repetition_tester *Tester)
+{
+    FreeBuffer(&Tester->SampleMemory);
+    Tester->Samples = 0;
+    Tester->MaxSampleCount = 0;
+    Tester->SampleCount = 0;
+}
+
+/* NOTE: Bootstrapping the min resamples the n test times with replacement and takes the min of
+   each resample. That min is above the kth smallest time only if all n draws missed the k smallest,
+   which happens with probability (1 - k/n)^n, so the 95% interval runs from the min to the kth
+   smallest time for the first k that makes this at most 2.5%, with no resampling needed. Since
+   (1 - k/n)^n < e^-k, k is never more than 4, and it is exactly 4 from 9 tests on. */
+static u32 GetMinCIRank(u64 TestCount)
+{
+    u32 Result = 4;
+    if(TestCount < 9)
+    {
+        for(Result = 1; Result < 4; ++Result)
+        {
+            f64 Step = 1.0 - (f64)Result / (f64)TestCount;
+            f64 Above = 1.0;
+            for(u64 Draw = 0; Draw < TestCount; ++Draw)
+            {
+                Above *= Step;
+            }
+            
+            if(Above <= 0.025)
+            {
+                break;
+            }
+        }
+    }
+    
+    if(Result > TestCount)
+    {
+        Result = (u32)TestCount;
+    }
+    
+    return Result;
+}
+
+static void RecordSample(repetition_tester *Tester, u64 CPUTime)
+{
+    if(Tester->SampleCount < Tester->MaxSampleCount)
+    {
+        Tester->Samples[Tester->SampleCount++] = CPUTime;
+    }
+    
+    // NOTE: Kept for every test, even once the buffer is full, since the interval for the min needs them
+    u64 *Smallest = Tester->SmallestTimes;
+    u32 Index = ArrayCount(Tester->SmallestTimes);
+    for(; (Index > 0) && (Smallest[Index - 1] > CPUTime); --Index)
+    {
+        if(Index < ArrayCount(Tester->SmallestTimes))
+        {
+            Smallest[Index] = Smallest[Index - 1];
+        }
+    }
+    if(Index < ArrayCount(Tester->SmallestTimes))
+    {
+        Smallest[Index] = CPUTime;
+    }
+}
+
+static b32 HasConverged(repetition_tester *Tester)
+{
+    b32 Result = false;
+    
+    u64 TestCount = Tester->Results.Total.E[RepValue_TestCount];
+    if((Tester->ConvergenceTolerance > 0) &&
+       (TestCount >= MIN_CONVERGENCE_SAMPLE_COUNT) &&
+       (Tester->TestsSinceNewMin >= MIN_CONVERGENCE_SAMPLE_COUNT))
+    {
+        f64 Min = (f64)Tester->SmallestTimes[0];
+        f64 High = (f64)Tester->SmallestTimes[GetMinCIRank(TestCount) - 1];
+        Result = ((High - Min) <= Tester->ConvergenceTolerance*Min);
+    }
+    
+    return Result;
+}
+
+static int CompareSamples(void const *A, void const *B)
+{
+    u64 ValueA = *(u64 const *)A;
+    u64 ValueB = *(u64 const *)B;
+    int Result = (ValueA < ValueB) ? -1 : (ValueA > ValueB);
+    return Result;
+}
+
+static f64 GetSortedQuantile(u64 *Sorted, u64 Count, f64 Fraction)
+{
+    f64 Position = Fraction*(f64)(Count - 1);
+    u64 Below = (u64)Position;
+    
+    f64 Result = (f64)Sorted[Below];
+    if((Below + 1) < Count)
+    {
+        Result += (Position - (f64)Below)*((f64)Sorted[Below + 1] - (f64)Sorted[Below]);
+    }
+    
+    return Result;
+}
+
+// NOTE: Deviations grow leftward below the median and rightward above it, so walking outward from
+// the middle visits them in order, and the median deviation comes out without a second sort.
+static f64 GetSortedMAD(u64 *Sorted, u64 Count, f64 Median)
+{
+    u64 LeftCount = (Count + 1) / 2;
+    u64 Right = LeftCount;
+    
+    f64 Lower = 0;
+    f64 Upper = 0;
+    for(u64 Rank = 0; Rank <= (Count / 2); ++Rank)
+    {
+        b32 TakeLeft = (LeftCount > 0) &&
+            ((Right >= Count) || ((Median - (f64)Sorted[LeftCount - 1]) <= ((f64)Sorted[Right] - Median)));
+        
+        f64 Deviation = 0;
+        if(TakeLeft)
+        {
+            Deviation = Median - (f64)Sorted[--LeftCount];
+        }
+        else
+        {
+            Deviation = (f64)Sorted[Right++] - Median;
+        }
+        
+        if(Rank == ((Count - 1) / 2))
+        {
+            Lower = Deviation;
+        }
+        if(Rank == (Count / 2))
+        {
+            Upper = Deviation;
+        }
+    }
+    
+    f64 Result = 0.5*(Lower + Upper);
+    return Result;
+}
+
+static repetition_value SampleValue(f64 CPUTime, u64 ByteCount, u64 CPUTimerFreq)
+{
+    repetition_value Result = {};
+    Result.E[RepValue_TestCount] = 1;
+    Result.E[RepValue_CPUTimer] = (u64)(CPUTime + 0.5);
+    Result.E[RepValue_ByteCount] = ByteCount;
+    ComputeDerivedValues(&Result, CPUTimerFreq);
+    
+    return Result;
+}
+
+// NOTE: Sorts the samples in place; their order doesn't matter to anything else
+static void ComputeSampleStats(repetition_tester *Tester)
+{
+    repetition_test_results *Results = &Tester->Results;
+    u64 Count = Tester->SampleCount;
+    u64 TestCount = Results->Total.E[RepValue_TestCount];
+    u64 ByteCount = Tester->TargetProcessedByteCount;
+    u64 CPUTimerFreq = Tester->CPUTimerFreq;
+    
+    Results->SampleCount = Count;
+    if(Count)
+    {
+        u64 *Sorted = Tester->Samples;
+        qsort(Sorted, Count, sizeof(u64), CompareSamples);
+        
+        f64 Median = GetSortedQuantile(Sorted, Count, 0.5);
+        Results->Median = SampleValue(Median, ByteCount, CPUTimerFreq);
+        Results->MAD = SampleValue(GetSortedMAD(Sorted, Count, Median), 0, CPUTimerFreq);
+        Results->P5 = SampleValue(GetSortedQuantile(Sorted, Count, 0.05), ByteCount, CPUTimerFreq);
+        Results->P95 = SampleValue(GetSortedQuantile(Sorted, Count, 0.95), ByteCount, CPUTimerFreq);
+        
+        u64 MinCIHigh = Tester->SmallestTimes[GetMinCIRank(TestCount) - 1];
+        Results->MinCIHigh = SampleValue((f64)MinCIHigh, ByteCount, CPUTimerFreq);
+    }
+}
+
 static b32 IsTesting(repetition_tester *Tester)
 {
     if(Tester->Mode == TestMode_Testing)
@@ -243,6 +695,9 @@ static b32 IsTesting(repetition_tester *Tester)
                     Results->Total.E[EIndex] += Accum.E[EIndex];
                 }
                 
+                RecordSample(Tester, Accum.E[RepValue_CPUTimer]);
+                ++Tester->TestsSinceNewMin;
+                
                 if(Results->Max.E[RepValue_CPUTimer] < Accum.E[RepValue_CPUTimer])
                 {
                     Results->Max = Accum;
@@ -254,6 +709,7 @@ static b32 IsTesting(repetition_tester *Tester)
                     
                     // NOTE(casey): Whenever we get a new minimum time, we reset the clock to the full trial time
                     Tester->TestsStartedAt = CurrentTime;
+                    Tester->TestsSinceNewMin = 0;
                     
                     if(Tester->PrintNewMinimums)
                     {
@@ -269,16 +725,20 @@ static b32 IsTesting(repetition_tester *Tester)
             }
         }
         
-        if((CurrentTime - Tester->TestsStartedAt) > Tester->TryForTime)
+        if(((CurrentTime - Tester->TestsStartedAt) > Tester->TryForTime) || HasConverged(Tester))
         {
             Tester->Mode = TestMode_Completed;
 
+            ComputeSampleStats(Tester);
             ComputeDerivedValues(&Tester->Results.Total, Tester->CPUTimerFreq);
             ComputeDerivedValues(&Tester->Results.Min, Tester->CPUTimerFreq);
             ComputeDerivedValues(&Tester->Results.Max, Tester->CPUTimerFreq);
             
-            printf("                                                          \r");
-            PrintResults(Tester->Results);
+            if(!Tester->Quiet)
+            {
+                printf("                                                          \r");
+                PrintResults(Tester->Results);
+            }
         }
     }
     
@@ -403,6 +863,9 @@ static b32 IsTesting(repetition_test_series *Series, repetition_tester *Tester)
                 ++Series->RowIndex;
             }
         }
+        
+        // NOTE: A series tester only ever runs one wave, and its statistics are in the results now
+        FreeTestSamples(Tester);
     }
     
     return Result;